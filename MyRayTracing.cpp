@@ -8,67 +8,86 @@
 #include "hittable_list.h"
 #include "material.h"
 #include "sphere.h"
+#include "scenes.h"
+#include "scene_file.h"
+#include "bvh_cache.h"
+#include "triangle_mesh.h"
+#include "obj_loader.h"
 
 
-int main() {
+// 不带参数渲染内置场景；带一个场景文件（文本或二进制）或 OBJ 网格时渲染文件里的场景
+int main(int argc, char** argv) {
      // 开始计时点
     auto start = std::chrono::high_resolution_clock::now();
-    hittable_list world;
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
+    thread_pool pool;
+    // 加速结构按本机实测的单位代价挑选：线性扫描、二叉BVH或4/8路宽BVH，约0.1秒
+    host_accel_costs() = calibrate_accel_costs();
+    scene_desc scene;
+    scene_file file;
+    sphere_soup soup;
+    std::string path = argc > 1 ? argv[1] : "";
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0) {
+        // 三角网格：整个网格是一个物体，自带一棵三角形BVH；相机从包围球外斜上方看向中心
+        std::vector<point3> vertices;
+        std::vector<uint32_t> indices;
+        obj_load_stats load;
+        if (!load_obj(path, vertices, indices, &load))
+            return 1;
+        auto mesh = scene.arena.make<triangle_mesh>(std::move(vertices), std::move(indices),
+            scene.arena.make<lambertian>(color(0.5, 0.5, 0.5)), &pool);
+        std::cout << "OBJ读取: " << load.triangles << " 个三角形, " << load.bytes / (1024.0 * 1024.0) << " MB, "
+            << load.ms << " 毫秒 (" << load.mb_per_second() << " MB/s); 网格内存 "
+            << double(mesh->MemoryBytes()) / std::max(1, mesh->triangleCount()) << " 字节/三角形" << std::endl;
+        scene.world.add(mesh);
+        scene.vfov = 40.f;
+        scene.lookat = mesh->getCenter();
+        float distance = 1.2f * mesh->getRadius() / std::tan(degrees_to_radians(scene.vfov) / 2);
+        scene.lookfrom = scene.lookat + distance * unit_vector(vec3(0.3f, 0.4f, 1.0f));
+        scene.accelerate(&pool);
     }
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-   
-    BVHNode* node = BuildBVH(world.objects, 0, world.objects.size(), 5);
+    else if (argc > 1) {
+        // 二进制场景直接映射进内存，soup 按BVH叶子顺序间接读取文件里的数组，不为每个球分配对象。
+        // BVH存在场景旁边的 .bvh 文件里，场景和构建参数没变时直接映射回来，不再重建
+        if (!file.open(argv[1]))
+            return 1;
+        scene.lookfrom = file.lookfrom();
+        scene.lookat = file.lookat();
+        scene.vfov = file.vfov();
+        bool cached = false;
+        LinearBVH bvh = CachedLinearBVHFromBounds(path + ".bvh", file.size(), [&file](int i) { return file.bounds(i); },
+            8, SplitMethod::SAH, &pool, soup_lanes::width, &cached);
+        std::cout << (cached ? "BVH缓存命中: " : "BVH缓存未命中，已重建并写入: ") << path << ".bvh" << std::endl;
+        scene.accel = std::make_unique<accelerator>();
+        // 上千万个球时节点本身就是几百MB：改用8位量化的8叉树，节点内存约为普通8叉树的三分之一
+        scene.accel->compressed = file.size() >= 10000000;
+        scene.accel->adopt(std::move(bvh), &soup);
+        file.make_soup(&scene.accel->getBVH().primIndices, scene.arena, soup);
+    }
+    else {
+        // 固定种子的场景，每次运行都一样
+        scene = final_scene();
+        // 场景全是球体：按BVH叶子顺序拷一份SoA数据，叶子求交走SIMD，SAH按块计代价
+        scene.accelerate(&pool);
+    }
+    hittable_list& world = scene.world;
+    const LinearBVH& bvh = scene.accel->getBVH();
+    std::cout << "BVH构建时间: " << bvh.buildMs << " 毫秒, " << bvh.nodes.size() << " 个节点" << std::endl;
+    std::cout << "加速结构: " << scene.accel->describe() << std::endl;
     camera cam;
 
     cam.aspect_ratio = 16.0 / 9.0;
     cam.image_width = 1200;
     cam.samples_per_pixel = 500;
 
-    cam.vfov = 20.f;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
+    cam.vfov = scene.vfov;
+    cam.lookfrom = scene.lookfrom;
+    cam.lookat = scene.lookat;
     cam.RR_rate = 0.85f;
-    cam.node = node;
-    cam.objectNum = world.objects.size();
+    // 自适应采样：500 变成平均每像素的预算，天空这类一眼收敛的像素提前停，样本留给玻璃和模糊金属
+    cam.adaptive = true;
+    // 渲染要跑很久：每分钟写一次断点，进程被杀后重新运行会从断点继续
+    cam.checkpoint_file = "output.ckpt";
+    cam.accel = scene.accel.get();
 
     cam.render(world);
     // 结束计时点
@@ -0,0 +1,391 @@
+#pragma once
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+// The acceleration structure of a scene behind one intersect call. The binary
+// BVH is always built; the accelerator then estimates what a ray costs with a
+// linear scan, the binary tree and the 4 and 8 wide trees collapsed from it,
+// and keeps the cheapest. The estimate is the surface area heuristic the
+// builder uses, with the unit costs measured in nanoseconds: a ray entering
+// the scene box enters every other box with the probability of its area over
+// the root area. The unit costs come with defaults and can be measured on the
+// running host by calibrate_accel_costs().
+//
+// The quantized 8 wide tree (quantizedBVH.h) is not a candidate by default: it
+// saves memory rather than time. Setting `compressed` makes it the only tree
+// considered, and the binary nodes are released once it is picked.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "rtweekend.h"
+#include "bvh_cache.h"
+#include "hittable.h"
+#include "material.h"
+#include "quantizedBVH.h"
+#include "raypacket.h"
+#include "sphere.h"
+#include "sphere_soup.h"
+#include "thread_pool.h"
+#include "wideBVH.h"
+
+enum class accel_kind { linear, bvh2, bvh4, bvh8, qbvh8 };
+const int accel_kind_count = 5;
+
+inline const char* accel_kind_name(accel_kind kind) {
+    static const char* names[accel_kind_count] = { "linear", "bvh2", "bvh4", "bvh8", "qbvh8" };
+    return names[int(kind)];
+}
+
+// Time of the steps a query is made of, in nanoseconds. The defaults are what
+// calibrate_accel_costs() measured on an x86-64 host with AVX-512.
+struct accel_costs {
+    float primitive = 6.0f;   // One hit_object test
+    float soupBlock = 8.0f;   // One soup_lanes::width block of sphere_soup::IntersectRange
+    float box = 21.0f;        // One LinearBVHNode box test with its stack push or pop
+    float node4 = 47.0f;      // One WideBVHNode<4>: slab test of the children and ordering the hits
+    float node8 = 50.0f;      // One WideBVHNode<8>
+    float qnode8 = 60.0f;     // One QuantizedBVHNode<8>, decoding the child boxes included
+    bool calibrated = false;
+};
+
+// The costs every accelerator uses unless given others. A program that wants
+// host numbers assigns calibrate_accel_costs() here before building scenes.
+inline accel_costs& host_accel_costs() {
+    static accel_costs costs;
+    return costs;
+}
+
+// Expected work for a ray that enters the root box.
+struct accel_work {
+    float rootArea = 1;
+    float leafBlocks = 0;  // Leaf tests in primitives or soup blocks, the oversized primitives included
+    float boxTests = 0;    // Binary: the root and both children of every interior node entered
+};
+
+template <int N>
+float ExpectedWideNodes(const WideBVH<N>& wide, float rootArea) {
+    float expected = 0;
+    for (const WideBVHNode<N>& node : wide.nodes) {
+        Bounds3 b;
+        for (int i = 0; i < N; ++i) {
+            if (node.child[i] < 0) continue;
+            b = uni(b, Bounds3(point3(node.minX[i], node.minY[i], node.minZ[i]),
+                point3(node.maxX[i], node.maxY[i], node.maxZ[i])));
+        }
+        expected += b.SurfaceArea() / rootArea;
+    }
+    return expected;
+}
+
+template <int N>
+float ExpectedQuantizedNodes(const QuantizedBVH<N>& q, float rootArea) {
+    float expected = 0;
+    for (const QuantizedBVHNode<N>& node : q.nodes) {
+        int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+        for (int i = 0; i < N; ++i) {
+            if (!node.meta[i]) continue;
+            for (int axis = 0; axis < 3; ++axis) {
+                lo[axis] = std::min(lo[axis], int(node.qmin[axis][i]));
+                hi[axis] = std::max(hi[axis], int(node.qmax[axis][i]));
+            }
+        }
+        float d[3];
+        for (int axis = 0; axis < 3; ++axis)
+            d[axis] = std::max(0, hi[axis] - lo[axis]) * QuantizedStep(node.exponent[axis]);
+        expected += 2 * (d[0] * d[1] + d[0] * d[2] + d[1] * d[2]) / rootArea;
+    }
+    return expected;
+}
+
+// Leaf tests and binary box tests; the wide trees are counted on their own.
+inline accel_work EstimateWork(const LinearBVH& bvh, int leafWidth) {
+    accel_work work;
+    work.leafBlocks = LeafCost(bvh.oversizedCount, leafWidth);
+    if (bvh.empty())
+        return work;
+    work.rootArea = std::max(bvh.nodes[0].bounds.SurfaceArea(), 1e-20f);
+    work.boxTests = 1;
+    for (const LinearBVHNode& node : bvh.nodes) {
+        float p = node.bounds.SurfaceArea() / work.rootArea;
+        if (node.nPrimitives > 0)
+            work.leafBlocks += p * LeafCost(node.nPrimitives, leafWidth);
+        else
+            work.boxTests += 2 * p;
+    }
+    return work;
+}
+
+class accelerator {
+public:
+    accelerator() = default;
+    // The wide trees point at bvh, so the accelerator stays where it was built
+    accelerator(const accelerator&) = delete;
+    accelerator& operator=(const accelerator&) = delete;
+
+    // Builds the tree over objects and picks the structure. All-sphere lists
+    // get a soup in leaf order, so the leaves are tested with SIMD.
+    void build(const std::vector<shared_ptr<hittable>>& objects, thread_pool* pool = nullptr,
+        const accel_costs& costs = host_accel_costs()) {
+        bool allSpheres = std::all_of(objects.begin(), objects.end(),
+            [](const shared_ptr<hittable>& o) { return o->getType() == hittable_type::sphere; });
+        LinearBVH tree = BuildLinearBVH(objects, 8, SplitMethod::SAH, pool, allSpheres ? soup_lanes::width : 1);
+        ownSoup = sphere_soup();
+        choose(std::move(tree), allSpheres ? &ownSoup : nullptr, costs);
+        if (allSpheres)
+            BuildSphereSoup(objects, &bvh.primIndices, ownSoup);
+    }
+
+    // Takes a tree built elsewhere (a cache file, a refitter). soup, when
+    // given, must outlive the accelerator and hold the primitives in the order
+    // of getBVH().primIndices after this call; the quantized tree reorders
+    // them, so a soup is filled only once the tree is adopted. Without a soup
+    // the tree's object list is tested.
+    void adopt(LinearBVH tree, const sphere_soup* soup, const accel_costs& costs = host_accel_costs()) {
+        choose(std::move(tree), soup, costs);
+    }
+
+    // The next version of the adopted tree over the same primitives, e.g. after
+    // a refit. The structure picked for the first one is kept; the soup again
+    // follows getBVH().primIndices.
+    void update(LinearBVH tree) {
+        bvh = std::move(tree);
+        collapse();
+    }
+
+    bool hit(const ray& r, hit_record& rec, float tMin = 0.001f,
+        float tMax = std::numeric_limits<float>::max()) const {
+        switch (chosen) {
+        case accel_kind::bvh8: return soup ? WideBVHIntersect(bvh8, *soup, r, rec, tMin, tMax)
+            : WideBVHIntersect(bvh8, r, rec, tMin, tMax);
+        case accel_kind::bvh4: return soup ? WideBVHIntersect(bvh4, *soup, r, rec, tMin, tMax)
+            : WideBVHIntersect(bvh4, r, rec, tMin, tMax);
+        case accel_kind::qbvh8: return soup ? QuantizedBVHIntersect(qbvh8, *soup, r, rec, tMin, tMax)
+            : QuantizedBVHIntersect(qbvh8, r, rec, tMin, tMax);
+        case accel_kind::bvh2: return soup ? BVHIntersect(bvh, *soup, r, rec, tMin, tMax)
+            : BVHIntersect(bvh, r, rec, tMin, tMax);
+        default: break;
+        }
+        if (soup)
+            return soup->hit(r, interval(tMin, tMax), rec);
+        bool hitAny = false;
+        for (const auto& object : *bvh.objects) {
+            if (hit_object(*object, r, interval(tMin, tMax), rec)) {
+                tMax = rec.t;
+                hitAny = true;
+            }
+        }
+        return hitAny;
+    }
+
+    // Packets always go down the binary tree; see hasTree(). The quantized
+    // tree keeps no binary nodes, so it has none.
+    int hitPacket(ray_packet& packet, hit_record* recs) const {
+        return soup ? IntersectPacket(bvh, *soup, packet, recs) : IntersectPacket(bvh, packet, recs);
+    }
+    bool hasTree() const { return chosen != accel_kind::linear && !bvh.empty(); }
+
+    accel_kind kind() const { return chosen; }
+    int size() const { return count; }
+    float estimatedNs(accel_kind k) const { return estimate[int(k)]; }
+    const LinearBVH& getBVH() const { return bvh; }
+    size_t MemoryBytes() const {
+        return bvh.MemoryBytes() + bvh4.MemoryBytes() + bvh8.MemoryBytes() + qbvh8.MemoryBytes() + ownSoup.MemoryBytes();
+    }
+
+    // The choice and why, for the log.
+    std::string describe() const {
+        std::string line = std::string(accel_kind_name(chosen)) + " for " + std::to_string(count)
+            + (soup ? " spheres in a soup" : " objects") + ": lowest estimated cost per ray (";
+        const char* separator = "";
+        for (int k = 0; k < accel_kind_count; ++k) {
+            if (estimate[k] < 0) continue;  // Not a candidate
+            char part[48];
+            std::snprintf(part, sizeof(part), "%s%s %.4g", separator, accel_kind_name(accel_kind(k)), estimate[k]);
+            line += part;
+            separator = ", ";
+        }
+        return line + " ns; " + (calibrated ? "calibrated" : "default") + " costs)";
+    }
+
+    // Hash of every primitive and its material, for keys that must change
+    // with the scene (render checkpoints). Soup spheres are hashed from their
+    // arrays, other objects by their box and hittable::content_key().
+    uint64_t sceneKey(thread_pool* pool = nullptr) const {
+        if (soup) {
+            uint64_t key = chunked_hash(soup->size(), [this](int k, uint64_t key) {
+                key = mix64(key ^ (float_bits(soup->cx[k]) | float_bits(soup->cy[k]) << 32));
+                key = mix64(key ^ (float_bits(soup->cz[k]) | float_bits(soup->radius[k]) << 32));
+                return mix64(key ^ soup->materialId[k]);
+            }, pool);
+            for (const auto& mat : soup->materials)
+                key = mix64(key ^ material_key(*mat));
+            return key;
+        }
+        if (!bvh.objects)
+            return 0;
+        const auto& objects = *bvh.objects;
+        return chunked_hash(int(objects.size()), [&objects](int i, uint64_t key) {
+            const hittable& object = *objects[i];
+            return mix64(hash_bounds(key, object.bounding_box()) ^ object.content_key());
+        }, pool);
+    }
+
+    // Considers only the quantized tree, for scenes whose nodes would not
+    // otherwise fit in memory. Set before build() or adopt().
+    bool compressed = false;
+
+private:
+    LinearBVH bvh;
+    WideBVH4 bvh4;
+    WideBVH8 bvh8;
+    QuantizedBVH8 qbvh8;
+    sphere_soup ownSoup;
+    const sphere_soup* soup = nullptr;
+    accel_kind chosen = accel_kind::linear;
+    int count = 0;
+    float estimate[accel_kind_count] = {};
+    bool calibrated = false;
+
+    void choose(LinearBVH tree, const sphere_soup* leafSoup, const accel_costs& costs) {
+        bvh = std::move(tree);
+        soup = leafSoup;
+        count = int(bvh.primIndices.size());
+        calibrated = costs.calibrated;
+        int leafWidth = soup ? soup_lanes::width : 1;
+        float leafNs = soup ? costs.soupBlock : costs.primitive;
+
+        accel_work work = EstimateWork(bvh, leafWidth);
+        float leaves = work.leafBlocks * leafNs;
+        for (float& e : estimate) e = -1;
+        estimate[int(accel_kind::linear)] = LeafCost(count, leafWidth) * leafNs;
+        if (compressed) {
+            qbvh8 = CompressBVH<8>(bvh);
+            estimate[int(accel_kind::qbvh8)] = ExpectedQuantizedNodes(qbvh8, work.rootArea) * costs.qnode8 + leaves;
+        } else {
+            bvh4 = CollapseBVH<4>(bvh);
+            bvh8 = CollapseBVH<8>(bvh);
+            estimate[int(accel_kind::bvh2)] = work.boxTests * costs.box + leaves;
+            estimate[int(accel_kind::bvh4)] = ExpectedWideNodes(bvh4, work.rootArea) * costs.node4 + leaves;
+            estimate[int(accel_kind::bvh8)] = ExpectedWideNodes(bvh8, work.rootArea) * costs.node8 + leaves;
+        }
+
+        // Ties go to the simpler structure
+        chosen = accel_kind::linear;
+        if (!bvh.empty()) {
+            for (int k = 1; k < accel_kind_count; ++k)
+                if (estimate[k] >= 0 && estimate[k] < estimate[int(chosen)])
+                    chosen = accel_kind(k);
+        }
+        if (chosen != accel_kind::bvh4) bvh4 = WideBVH4();
+        if (chosen != accel_kind::bvh8) bvh8 = WideBVH8();
+        if (chosen != accel_kind::qbvh8) qbvh8 = QuantizedBVH8();
+        else ReleaseBinaryNodes();
+    }
+
+    void collapse() {
+        if (chosen == accel_kind::bvh4) bvh4 = CollapseBVH<4>(bvh);
+        if (chosen == accel_kind::bvh8) bvh8 = CollapseBVH<8>(bvh);
+        if (chosen == accel_kind::qbvh8) {
+            qbvh8 = CompressBVH<8>(bvh);
+            ReleaseBinaryNodes();
+        }
+    }
+
+    // The quantized tree is traversed alone: its leaves, not the binary
+    // ones, give the primitive order
+    void ReleaseBinaryNodes() {
+        bvh.nodes = bvh_array<LinearBVHNode>();
+        bvh.primIndices = qbvh8.primIndices;
+    }
+};
+
+// Measures accel_costs on this host, single threaded, in about a tenth of a
+// second: seeded random spheres are hit by rays from outside their box aimed
+// at points inside it, the rays the cost model describes. The primitive and
+// soup tests are timed alone; the node costs are what a whole traversal takes
+// beyond its expected leaf tests, per expected node.
+inline accel_costs calibrate_accel_costs() {
+    const int sphereCount = 4096;
+    const int rayCount = 1024;
+    const int scanCount = 256;  // Spheres per ray in the primitive and soup timings
+    pcg32 rng;
+    rng.seed(mix64(0xacce1), 0);
+    auto uniform = [&rng](float a, float b) { return a + (b - a) * float(rng.next() * (1.0 / 4294967296.0)); };
+
+    auto mat = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    std::vector<shared_ptr<hittable>> objects;
+    objects.reserve(sphereCount);
+    for (int i = 0; i < sphereCount; ++i)
+        objects.push_back(std::make_shared<sphere>(point3(uniform(-20, 20), uniform(-20, 20), uniform(-20, 20)),
+            uniform(0.1f, 0.5f), mat));
+    std::vector<ray> rays;
+    rays.reserve(rayCount);
+    while (int(rays.size()) < rayCount) {
+        vec3 d(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+        if (d.length_squared() > 1 || d.length_squared() < 1e-4f) continue;
+        point3 origin = 60 * unit_vector(d);
+        point3 target(uniform(-20, 20), uniform(-20, 20), uniform(-20, 20));
+        rays.emplace_back(origin, target - origin);
+    }
+
+    // Nanoseconds per ray of query(r), over at least 20 ms
+    volatile float sink = 0;
+    auto perRay = [&](auto&& query) {
+        float sum = 0;
+        for (const ray& r : rays)
+            sum += query(r);
+        size_t calls = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while (elapsed < 0.02) {
+            for (const ray& r : rays)
+                sum += query(r);
+            calls += rays.size();
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        sink = sink + sum;
+        return float(elapsed * 1e9 / double(calls));
+    };
+
+    accel_costs costs;
+    costs.calibrated = true;
+    costs.primitive = perRay([&](const ray& r) {
+        hit_record rec;
+        float tMax = std::numeric_limits<float>::max();
+        for (int i = 0; i < scanCount; ++i)
+            if (hit_object(*objects[i], r, interval(0.001f, tMax), rec)) tMax = rec.t;
+        return tMax;
+    }) / scanCount;
+
+    sphere_soup soup;
+    BuildSphereSoup(objects, nullptr, soup);
+    costs.soupBlock = perRay([&](const ray& r) {
+        float tMax = std::numeric_limits<float>::max();
+        return float(soup.IntersectRange(r, 0, scanCount, 0.001f, tMax));
+    }) / LeafCost(scanCount, soup_lanes::width);
+
+    LinearBVH bvh = BuildLinearBVH(objects, 8, SplitMethod::SAH);
+    WideBVH4 bvh4 = CollapseBVH<4>(bvh);
+    WideBVH8 bvh8 = CollapseBVH<8>(bvh);
+    QuantizedBVH8 qbvh8 = CompressBVH<8>(bvh);
+    accel_work work = EstimateWork(bvh, 1);
+    float leaves = work.leafBlocks * costs.primitive;
+    float floor = 0.1f * costs.primitive;  // A traversal faster than its leaves leaves nothing to divide
+    float bvh2Ns = perRay([&](const ray& r) { hit_record rec; return BVHIntersect(bvh, r, rec) ? rec.t : 0.0f; });
+    float bvh4Ns = perRay([&](const ray& r) { hit_record rec; return WideBVHIntersect(bvh4, r, rec) ? rec.t : 0.0f; });
+    float bvh8Ns = perRay([&](const ray& r) { hit_record rec; return WideBVHIntersect(bvh8, r, rec) ? rec.t : 0.0f; });
+    costs.box = std::max(floor, (bvh2Ns - leaves) / work.boxTests);
+    float qbvh8Ns = perRay([&](const ray& r) { hit_record rec; return QuantizedBVHIntersect(qbvh8, r, rec) ? rec.t : 0.0f; });
+    costs.node4 = std::max(floor, (bvh4Ns - leaves) / ExpectedWideNodes(bvh4, work.rootArea));
+    costs.node8 = std::max(floor, (bvh8Ns - leaves) / ExpectedWideNodes(bvh8, work.rootArea));
+    costs.qnode8 = std::max(floor, (qbvh8Ns - leaves) / ExpectedQuantizedNodes(qbvh8, work.rootArea));
+    return costs;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+// Frame loops for turntables and short animations of all-sphere scenes whose
+// spheres move but never appear or disappear. Everything that does not change
+// between frames is set up once: the thread pool, the material table, the
+// soup and the BVH. The BVH is refitted to the moved spheres each frame and
+// rebuilt only where its quality has degraded (bvh_refitter). The soup reads
+// the scene arrays in place through the BVH leaf order, so moving a sphere is
+// just a write to the arrays. The accelerator structure is picked for the
+// first frame and kept; a wide tree is collapsed again from every refit.
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "rtweekend.h"
+#include "accelerator.h"
+#include "bvh_refit.h"
+#include "camera.h"
+#include "scene_arena.h"
+#include "scene_file.h"
+#include "sphere_soup.h"
+#include "thread_pool.h"
+
+struct sequence_frame_stats {
+    int frame = 0;
+    double update_ms = 0;               // The caller's update
+    bvh_refitter::update_stats bvh;     // Frame 0: the initial build; ms includes collapsing a wide tree
+    double render_ms = 0;
+};
+
+// Renders frames [0, frames) of `scene`. Before every frame after the first,
+// update(frame, scene, cam) moves spheres (the count must not change) or the
+// camera. output_pattern is a printf pattern for the frame number, e.g.
+// "frame_%04d.ppm"; empty writes no images.
+template <class UpdateFn>
+std::vector<sequence_frame_stats> render_sequence(camera& cam, scene_data& scene, int frames, UpdateFn&& update,
+    const std::string& output_pattern) {
+    thread_pool pool(cam.thread_count);
+    thread_pool* previous_pool = cam.pool;
+    cam.pool = &pool;
+
+    scene_arena arena;
+    sphere_soup soup;
+    for (const scene_material& m : scene.materials)
+        soup.materials.push_back(make_material(m, arena));
+    auto bounds = [&scene](int i) {
+        float r = scene.radius[i];
+        point3 c(scene.cx[i], scene.cy[i], scene.cz[i]);
+        return Bounds3(c - vec3(r, r, r), c + vec3(r, r, r));
+    };
+
+    bvh_refitter refitter;
+    accelerator accel;
+    hittable_list nothing;  // Everything is in the soup
+    std::vector<sequence_frame_stats> stats;
+    for (int frame = 0; frame < frames; ++frame) {
+        sequence_frame_stats s;
+        s.frame = frame;
+        if (frame == 0) {
+            refitter.build(scene.size(), bounds, 8, SplitMethod::SAH, &pool, soup_lanes::width);
+            s.bvh.ms = refitter.getBVH().buildMs;
+            s.bvh.fullRebuild = true;
+            s.bvh.rebuiltPrimitives = scene.size();
+        }
+        else {
+            auto start = std::chrono::steady_clock::now();
+            update(frame, scene, cam);
+            s.update_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            s.bvh = refitter.update(bounds);
+        }
+
+        const LinearBVH& bvh = refitter.getBVH();
+        auto start = std::chrono::steady_clock::now();
+        if (frame == 0)
+            accel.adopt(bvh, &soup);
+        else
+            accel.update(bvh);
+        s.bvh.ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        // The arrays may have moved if the caller touched the vectors, and the
+        // accelerator may have reordered the primitives
+        soup.View(scene.cx.data(), scene.cy.data(), scene.cz.data(), scene.radius.data(), scene.materialId.data(),
+            scene.size(), accel.getBVH().primIndices.data());
+        if (frame == 0)
+            std::cout << "Accelerator: " << accel.describe() << "\n";
+        cam.accel = &accel;
+        if (output_pattern.empty()) {
+            cam.output_file.clear();
+        }
+        else {
+            std::vector<char> name(output_pattern.size() + 32);
+            std::snprintf(name.data(), name.size(), output_pattern.c_str(), frame);
+            cam.output_file = name.data();
+        }
+        cam.render(nothing);
+        s.render_ms = cam.last_render.render_ms;
+        stats.push_back(s);
+    }
+    cam.pool = previous_pool;
+    cam.accel = nullptr;
+    return stats;
+}
+
+#endif
@@ -0,0 +1,219 @@
+// benchmark.cpp : end-to-end render benchmark on fixed, seeded scenes.
+//
+// Usage: benchmark [--scenes final,100k,1m] [--width 400] [--spp 16] [--threads 0]   (10m and inst are also known)
+//                  [--json benchmark.json] [--calibrate 0|1] [--compressed 0|1]
+//
+// Every scene is built from a fixed seed, so two runs trace exactly the same
+// rays and the numbers can be compared between commits. Results are printed as
+// a table and written as JSON.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "scenes.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Starts a new high-water mark for peak_memory_mb(), so every scene reports
+// its own peak. Linux only (VmHWM through /proc/self/clear_refs); elsewhere
+// the peak is that of the whole process and this returns false. The heap
+// freed by the previous scene is handed back first, or it would count again.
+static bool reset_peak_memory() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+#if defined(__linux__)
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+    clear.close();
+    return !clear.fail();
+#else
+    return false;
+#endif
+}
+
+// Peak resident memory since the last reset_peak_memory(), or of the process
+// so far, in MB.
+static double peak_memory_mb() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::atof(line.c_str() + 6) / 1024.0;  // Kilobytes
+    }
+#endif
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);  // Bytes
+#else
+    return usage.ru_maxrss / 1024.0;             // Kilobytes
+#endif
+#endif
+}
+
+struct bench_result {
+    std::string name;
+    size_t objects = 0;
+    double scene_ms = 0;
+    double bvh_build_ms = 0;
+    double accel_select_ms = 0;     // The rest of accelerate(): collapses, estimates and the soup
+    size_t bvh_nodes = 0;
+    std::string accelerator;        // accel_kind_name of the structure picked
+    double accel_mb = 0;            // Its nodes, indices and soup
+    camera::render_stats render;
+    double peak_memory_mb = 0;
+    bool peak_memory_own = false;   // The scene's own peak, not the process's so far
+
+    double seconds() const { return render.render_ms / 1000.0; }
+    double camera_mrays() const { return render.camera_rays / seconds() / 1e6; }
+    double secondary_mrays() const { return render.secondary_rays / seconds() / 1e6; }
+    double total_mrays() const { return (render.camera_rays + render.secondary_rays) / seconds() / 1e6; }
+    double ns_per_sample() const { return render.render_ms * 1e6 / double(render.camera_rays); }
+};
+
+static bench_result run_scene(const std::string& name, int width, int spp, bool compressed, thread_pool& pool) {
+    bench_result result;
+    result.name = name;
+    result.peak_memory_own = reset_peak_memory();
+
+    auto t0 = std::chrono::steady_clock::now();
+    scene_desc scene;
+    named_scene(name, scene);
+    result.scene_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    result.objects = scene.world.objects.size();
+
+    auto t1 = std::chrono::steady_clock::now();
+    const accelerator& accel = scene.accelerate(&pool, host_accel_costs(), compressed);
+    double accelerate_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count();
+    result.bvh_build_ms = accel.getBVH().buildMs;
+    result.accel_select_ms = std::max(0.0, accelerate_ms - result.bvh_build_ms);
+    result.bvh_nodes = accel.getBVH().nodes.size();
+    result.accelerator = accel_kind_name(accel.kind());
+    result.accel_mb = accel.MemoryBytes() / (1024.0 * 1024.0);
+    std::cout << name << ": " << accel.describe() << "\n";
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = width;
+    cam.samples_per_pixel = spp;
+    cam.vfov = scene.vfov;
+    cam.lookfrom = scene.lookfrom;
+    cam.lookat = scene.lookat;
+    cam.accel = &accel;
+    cam.pool = &pool;
+    cam.output_file = "benchmark_" + name + ".ppm";
+    cam.render(scene.world);
+
+    result.render = cam.last_render;
+    result.peak_memory_mb = peak_memory_mb();
+    return result;
+}
+
+static void write_json(const std::string& path, const std::vector<bench_result>& results, int width, int spp,
+    int threads) {
+    std::ofstream out(path);
+    out << "{\n  \"width\": " << width << ",\n  \"samples_per_pixel\": " << spp
+        << ",\n  \"threads\": " << threads << ",\n  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const bench_result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\""
+            << ", \"objects\": " << r.objects
+            << ", \"scene_ms\": " << r.scene_ms
+            << ", \"bvh_build_ms\": " << r.bvh_build_ms
+            << ", \"accel_select_ms\": " << r.accel_select_ms
+            << ", \"bvh_nodes\": " << r.bvh_nodes
+            << ", \"accelerator\": \"" << r.accelerator << "\""
+            << ", \"accel_mb\": " << r.accel_mb
+            << ", \"render_ms\": " << r.render.render_ms
+            << ", \"camera_rays\": " << r.render.camera_rays
+            << ", \"secondary_rays\": " << r.render.secondary_rays
+            << ", \"camera_mrays_per_s\": " << r.camera_mrays()
+            << ", \"secondary_mrays_per_s\": " << r.secondary_mrays()
+            << ", \"total_mrays_per_s\": " << r.total_mrays()
+            << ", \"ns_per_sample\": " << r.ns_per_sample()
+            << ", \"peak_memory_mb\": " << r.peak_memory_mb
+            << ", \"peak_memory_per_scene\": " << (r.peak_memory_own ? "true" : "false") << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    std::string scenes = "final,100k,1m";
+    std::string json = "benchmark.json";
+    int width = 400;
+    int spp = 16;
+    int threads = 0;
+    bool calibrate = false;
+    bool compressed = false;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--scenes")) scenes = argv[i + 1];
+        else if (!std::strcmp(argv[i], "--json")) json = argv[i + 1];
+        else if (!std::strcmp(argv[i], "--width")) width = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--spp")) spp = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--threads")) threads = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--calibrate")) calibrate = std::atoi(argv[i + 1]) != 0;
+        else if (!std::strcmp(argv[i], "--compressed")) compressed = std::atoi(argv[i + 1]) != 0;
+        else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
+    // The default costs keep the structure of every scene the same from run to run
+    if (calibrate) {
+        host_accel_costs() = calibrate_accel_costs();
+        const accel_costs& c = host_accel_costs();
+        std::printf("Calibrated costs: primitive %.1f, soup block %.1f, box %.1f, node4 %.1f, node8 %.1f, "
+            "qnode8 %.1f ns\n", c.primitive, c.soupBlock, c.box, c.node4, c.node8, c.qnode8);
+    }
+    thread_pool pool(threads);
+    std::vector<bench_result> results;
+    size_t begin = 0;
+    while (begin <= scenes.size()) {
+        size_t end = scenes.find(',', begin);
+        if (end == std::string::npos) end = scenes.size();
+        std::string name = scenes.substr(begin, end - begin);
+        begin = end + 1;
+        if (name != "final" && name != "100k" && name != "1m" && name != "10m" && name != "inst") {
+            std::cerr << "Unknown scene " << name << "\n";
+            return 1;
+        }
+        results.push_back(run_scene(name, width, spp, compressed, pool));
+    }
+
+    std::printf("\n%-6s %9s %6s %8s %10s %9s %10s %10s %10s %10s %10s %9s\n", "scene", "objects", "accel", "accel MB",
+        "bvh ms", "select ms", "render ms", "cam Mr/s", "sec Mr/s", "all Mr/s", "ns/sample", "peak MB");
+    for (const auto& r : results) {
+        std::printf("%-6s %9zu %6s %8.1f %10.1f %9.1f %10.1f %10.2f %10.2f %10.2f %10.1f %9.1f\n", r.name.c_str(),
+            r.objects, r.accelerator.c_str(), r.accel_mb, r.bvh_build_ms, r.accel_select_ms, r.render.render_ms,
+            r.camera_mrays(), r.secondary_mrays(), r.total_mrays(), r.ns_per_sample(), r.peak_memory_mb);
+    }
+    if (!results.empty() && !results[0].peak_memory_own)
+        std::cout << "Peak MB is the process's peak so far: this platform cannot reset it per scene\n";
+    write_json(json, results, width, spp, threads);
+    std::cout << "Wrote " << json << "\n";
+}
@@ -0,0 +1,278 @@
+#pragma once
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+// Built BVHs saved to disk and mapped back on later runs. The file holds the
+// flattened nodes and the leaf primitive indices at 64 byte aligned offsets, so
+// a loaded LinearBVH points straight into the mapping: no copy, no parse, the
+// pages come in as traversal touches them.
+//
+// A cache file is keyed by a hash of every primitive box and of the build
+// settings (leaf size, split method, leaf width). Any change to the scene or
+// the settings gives another key and the tree is rebuilt and the file
+// rewritten. A file from another version, a truncated file, one whose nodes
+// or indices no longer match the checksum written with them, or one whose tree
+// does not hold together is treated the same way. Bump BVH_CACHE_VERSION
+// whenever the builder changes the trees it makes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "rtweekend.h"
+#include "checkpoint.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+struct bvh_cache_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t node_size;         // sizeof(LinearBVHNode), catches layout changes
+    uint64_t key;               // bvh_cache_key of the primitives and settings
+    uint64_t primitive_count;
+    uint64_t node_count;
+    uint64_t index_count;       // Leaf references and oversized primitives, primitive_count
+    uint64_t oversized_offset;  // LinearBVH::oversizedOffset / oversizedCount
+    uint64_t oversized_count;
+    uint64_t nodes_offset;
+    uint64_t indices_offset;
+    uint64_t file_size;
+    uint64_t checksum;          // bvh_cache_checksum of the node and index arrays
+};
+
+const char BVH_CACHE_MAGIC[8] = { 'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0' };
+const uint32_t BVH_CACHE_VERSION = 3;
+const uint64_t BVH_CACHE_ALIGNMENT = 64;
+const int BVH_CACHE_HASH_CHUNK = 1 << 16;  // Primitives per hash chunk, fixed so the key ignores the thread count
+
+inline uint64_t bvh_cache_align(uint64_t offset) {
+    return (offset + BVH_CACHE_ALIGNMENT - 1) & ~(BVH_CACHE_ALIGNMENT - 1);
+}
+
+inline uint64_t float_bits(float v) {
+    uint32_t b;
+    std::memcpy(&b, &v, sizeof(b));
+    return uint64_t(b);
+}
+
+inline uint64_t hash_bounds(uint64_t key, const Bounds3& b) {
+    key = mix64(key ^ (float_bits(b.pMin[0]) | float_bits(b.pMin[1]) << 32));
+    key = mix64(key ^ (float_bits(b.pMin[2]) | float_bits(b.pMax[0]) << 32));
+    return mix64(key ^ (float_bits(b.pMax[1]) | float_bits(b.pMax[2]) << 32));
+}
+
+// Hash of n items, where item(i, key) returns key with item i mixed in. Chunks
+// of items are hashed in parallel and the chunk hashes chained in order.
+template <class ItemFn>
+uint64_t chunked_hash(int n, ItemFn&& item, thread_pool* pool = nullptr) {
+    int chunks = (n + BVH_CACHE_HASH_CHUNK - 1) / BVH_CACHE_HASH_CHUNK;
+    std::vector<uint64_t> chunkKeys(chunks);
+    auto hashChunk = [&](int c) {
+        uint64_t key = mix64(uint64_t(c));
+        int end = std::min(n, (c + 1) * BVH_CACHE_HASH_CHUNK);
+        for (int i = c * BVH_CACHE_HASH_CHUNK; i < end; ++i)
+            key = item(i, key);
+        chunkKeys[c] = key;
+    };
+    if (pool && chunks > 1)
+        pool->parallel_for(chunks, hashChunk);
+    else
+        for (int c = 0; c < chunks; ++c)
+            hashChunk(c);
+
+    uint64_t key = mix64(uint64_t(n));
+    for (uint64_t chunkKey : chunkKeys)
+        key = mix64(key ^ chunkKey);
+    return key;
+}
+
+// Hash of the n primitive boxes and the build settings
+template <class BoundsFn>
+uint64_t bvh_cache_key(int n, BoundsFn&& bounds, int maxLeafSize, SplitMethod splitMethod, int leafWidth,
+    thread_pool* pool = nullptr) {
+    uint64_t key = chunked_hash(n, [&bounds](int i, uint64_t key) { return hash_bounds(key, bounds(i)); }, pool);
+    for (uint64_t v : { uint64_t(maxLeafSize), uint64_t(splitMethod), uint64_t(leafWidth) })
+        key = mix64(key ^ v);
+    return key;
+}
+
+// Checks that the nodes form one depth-first tree: the left child follows its
+// parent, the right child starts where the left subtree ends, leaves reference
+// indices inside the array and no path is deeper than the traversal stacks.
+// Returns the end of the subtree at `node`, or -1.
+inline int64_t bvh_cache_check_subtree(const LinearBVHNode* nodes, uint64_t count, uint64_t indexCount,
+    uint64_t node, int depth) {
+    if (node >= count || depth > 64)
+        return -1;
+    const LinearBVHNode& n = nodes[node];
+    if (n.nPrimitives > 0) {
+        bool inside = n.primitivesOffset >= 0 && uint64_t(n.primitivesOffset) + n.nPrimitives <= indexCount;
+        return inside ? int64_t(node + 1) : -1;
+    }
+    int64_t leftEnd = bvh_cache_check_subtree(nodes, count, indexCount, node + 1, depth + 1);
+    if (leftEnd < 0 || n.secondChildOffset != leftEnd || n.axis > 2)
+        return -1;
+    return bvh_cache_check_subtree(nodes, count, indexCount, uint64_t(leftEnd), depth + 1);
+}
+
+// Hash of the node and index arrays as they lie in the file, 8 bytes at a
+// time in chunks on the pool. An odd index count leaves 4 bytes, hashed one
+// by one.
+inline uint64_t bvh_cache_checksum(const char* base, const bvh_cache_header& h, thread_pool* pool = nullptr) {
+    auto hashBytes = [pool](const char* data, uint64_t bytes) {
+        int words = int(bytes / sizeof(uint64_t));
+        uint64_t key = chunked_hash(words, [data](int i, uint64_t key) {
+            uint64_t word;
+            std::memcpy(&word, data + size_t(i) * sizeof(word), sizeof(word));
+            return mix64(key ^ word);
+        }, pool);
+        for (uint64_t i = uint64_t(words) * sizeof(uint64_t); i < bytes; ++i)
+            key = mix64(key ^ uint8_t(data[i]));
+        return key;
+    };
+    uint64_t nodes = hashBytes(base + h.nodes_offset, h.node_count * sizeof(LinearBVHNode));
+    uint64_t indices = hashBytes(base + h.indices_offset, h.index_count * sizeof(int));
+    return mix64(nodes ^ mix64(indices));
+}
+
+inline bool bvh_cache_valid(const char* base, size_t size, uint64_t key, int n, thread_pool* pool = nullptr) {
+    if (size < sizeof(bvh_cache_header))
+        return false;
+    const bvh_cache_header& h = *reinterpret_cast<const bvh_cache_header*>(base);
+    if (std::memcmp(h.magic, BVH_CACHE_MAGIC, sizeof(h.magic)) != 0 || h.version != BVH_CACHE_VERSION
+        || h.node_size != sizeof(LinearBVHNode) || h.key != key || h.primitive_count != uint64_t(n)
+        || h.index_count != uint64_t(n) || h.node_count == 0 || h.file_size != size
+        || h.oversized_offset + h.oversized_count != h.index_count || h.oversized_count > uint64_t(n))
+        return false;
+    if (h.nodes_offset != bvh_cache_align(sizeof(h))
+        || h.indices_offset != bvh_cache_align(h.nodes_offset + h.node_count * sizeof(LinearBVHNode))
+        || h.file_size != h.indices_offset + h.index_count * sizeof(int))
+        return false;
+    // The structure checks below cannot see a damaged box, which would cull geometry silently
+    if (bvh_cache_checksum(base, h, pool) != h.checksum)
+        return false;
+
+    const LinearBVHNode* nodes = reinterpret_cast<const LinearBVHNode*>(base + h.nodes_offset);
+    if (bvh_cache_check_subtree(nodes, h.node_count, h.index_count, 0, 0) != int64_t(h.node_count))
+        return false;
+    const int* indices = reinterpret_cast<const int*>(base + h.indices_offset);
+    for (uint64_t i = 0; i < h.index_count; ++i) {
+        if (indices[i] < 0 || indices[i] >= n)
+            return false;
+    }
+    return true;
+}
+
+// Maps the tree for `key` from path. Fails, leaving bvh alone, when the file
+// is missing, stale or damaged.
+inline bool load_bvh_cache(const std::string& path, uint64_t key, int n, LinearBVH& bvh,
+    thread_pool* pool = nullptr) {
+    auto file = std::make_shared<mapped_file>();
+    if (!file->open_read(path) || !bvh_cache_valid(file->data(), file->size(), key, n, pool))
+        return false;
+    const bvh_cache_header& h = *reinterpret_cast<const bvh_cache_header*>(file->data());
+    const char* base = file->data();
+    bvh.nodes = bvh_array<LinearBVHNode>(file, reinterpret_cast<const LinearBVHNode*>(base + h.nodes_offset),
+        size_t(h.node_count));
+    bvh.primIndices = bvh_array<int>(file, reinterpret_cast<const int*>(base + h.indices_offset),
+        size_t(h.index_count));
+    bvh.oversizedOffset = int(h.oversized_offset);
+    bvh.oversizedCount = int(h.oversized_count);
+    return true;
+}
+
+// Writes next to path and renames over it, so a reader never maps a torn file.
+inline bool save_bvh_cache(const std::string& path, uint64_t key, int n, const LinearBVH& bvh,
+    thread_pool* pool = nullptr) {
+    if (bvh.empty() || bvh.primIndices.size() != size_t(n))
+        return false;
+    bvh_cache_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, BVH_CACHE_MAGIC, sizeof(h.magic));
+    h.version = BVH_CACHE_VERSION;
+    h.node_size = sizeof(LinearBVHNode);
+    h.key = key;
+    h.primitive_count = uint64_t(n);
+    h.node_count = bvh.nodes.size();
+    h.index_count = bvh.primIndices.size();
+    h.oversized_offset = uint64_t(bvh.oversizedOffset);
+    h.oversized_count = uint64_t(bvh.oversizedCount);
+    h.nodes_offset = bvh_cache_align(sizeof(h));
+    h.indices_offset = bvh_cache_align(h.nodes_offset + h.node_count * sizeof(LinearBVHNode));
+    h.file_size = h.indices_offset + h.index_count * sizeof(int);
+
+    std::string tmp = path + ".tmp";
+    {
+        mapped_file file;
+        if (!file.create(tmp, size_t(h.file_size)))
+            return false;
+        char* out = file.data();
+        std::memset(out, 0, size_t(h.nodes_offset));
+        std::memcpy(out, &h, sizeof(h));
+        std::memcpy(out + h.nodes_offset, bvh.nodes.data(), bvh.nodes.size() * sizeof(LinearBVHNode));
+        std::memcpy(out + h.indices_offset, bvh.primIndices.data(), bvh.primIndices.size() * sizeof(int));
+        h.checksum = bvh_cache_checksum(out, h, pool);
+        std::memcpy(out, &h, sizeof(h));
+        if (!file.flush()) {
+            file.close();
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (!replace_file(tmp, path)) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// BuildLinearBVHFromBounds with a cache file: maps the tree from `path` when
+// it was saved for the same boxes and settings, otherwise builds it and saves
+// it there. buildMs is the time spent either way (hashing included); `loaded`
+// tells which way it went.
+template <class BoundsFn>
+LinearBVH CachedLinearBVHFromBounds(
+    const std::string& path,
+    int n,
+    BoundsFn&& bounds,
+    int maxLeafSize,
+    SplitMethod splitMethod = SplitMethod::SAH,
+    thread_pool* pool = nullptr,
+    int leafWidth = 1,
+    bool* loaded = nullptr
+) {
+    auto start = std::chrono::high_resolution_clock::now();
+    uint64_t key = bvh_cache_key(n, bounds, maxLeafSize, splitMethod, leafWidth, pool);
+    LinearBVH bvh;
+    bool hit = load_bvh_cache(path, key, n, bvh, pool);
+    if (!hit) {
+        bvh = BuildLinearBVHFromBounds(n, bounds, maxLeafSize, splitMethod, pool, leafWidth);
+        if (!save_bvh_cache(path, key, n, bvh, pool) && n > 0)
+            std::cerr << path << ": cannot write the BVH cache\n";
+    }
+    if (loaded) *loaded = hit;
+    auto end = std::chrono::high_resolution_clock::now();
+    bvh.buildMs = std::chrono::duration<float, std::milli>(end - start).count();
+    return bvh;
+}
+
+inline LinearBVH CachedLinearBVH(
+    const std::string& path,
+    const std::vector<std::shared_ptr<hittable>>& objects,
+    int maxLeafSize,
+    SplitMethod splitMethod = SplitMethod::SAH,
+    thread_pool* pool = nullptr,
+    int leafWidth = 1,
+    bool* loaded = nullptr
+) {
+    LinearBVH bvh = CachedLinearBVHFromBounds(path, int(objects.size()),
+        [&objects](int i) { return objects[i]->bounding_box(); }, maxLeafSize, splitMethod, pool, leafWidth, loaded);
+    bvh.objects = &objects;
+    return bvh;
+}
+
+#endif
@@ -0,0 +1,241 @@
+#pragma once
+#ifndef BVH_REFIT_H
+#define BVH_REFIT_H
+
+// A LinearBVH kept fitted to primitives that move between frames while their
+// count stays the same. update() refits every node box bottom-up from the new
+// primitive boxes, which keeps the tree correct but lets its quality drift as
+// siblings start to overlap. Quality is tracked per subtree as its SAH cost
+// per unit of surface area: the expected number of traversal steps and leaf
+// tests for a ray that enters the subtree's box, on the same cost model the
+// builder uses. A subtree whose cost grew past rebuildThreshold times its
+// cost when it was built is rebuilt in place. When that would take more than
+// half of the primitives, the whole tree is rebuilt instead.
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include "rtweekend.h"
+#include "thread_pool.h"
+
+class bvh_refitter {
+public:
+    float rebuildThreshold = 1.3f;  // Subtree cost over its cost when built that triggers a rebuild
+    int minRebuildPrimitives = 64;  // Smaller subtrees are left alone, their cost is mostly noise
+
+    struct update_stats {
+        float ms = 0;               // Refit, quality check and any rebuild
+        float costRatio = 1;        // Root cost over its cost when built, after the update
+        int rebuiltSubtrees = 0;
+        int rebuiltPrimitives = 0;
+        bool fullRebuild = false;
+    };
+
+    template <class BoundsFn>
+    void build(int n, BoundsFn&& bounds, int maxLeafSize, SplitMethod splitMethod = SplitMethod::SAH,
+        thread_pool* pool = nullptr, int leafWidth = 1) {
+        auto start = std::chrono::high_resolution_clock::now();
+        this->n = n;
+        this->maxLeafSize = maxLeafSize;
+        this->splitMethod = splitMethod;
+        this->pool = pool;
+        this->leafWidth = leafWidth;
+        ComputePrimitiveInfo(n, bounds, pool, info);
+        rebuildAll();
+        auto end = std::chrono::high_resolution_clock::now();
+        bvh.buildMs = std::chrono::duration<float, std::milli>(end - start).count();
+    }
+
+    // Takes the primitive boxes of the next frame.
+    template <class BoundsFn>
+    update_stats update(BoundsFn&& bounds) {
+        auto start = std::chrono::high_resolution_clock::now();
+        update_stats stats;
+        ComputePrimitiveInfo(n, bounds, pool, info);
+        refit();
+
+        std::vector<int> degraded;
+        int degradedPrimitives = 0;
+        if (!nodes->empty())
+            findDegraded(0, degraded, degradedPrimitives);
+        if (!degraded.empty()) {
+            if (degraded[0] == 0 || 2 * degradedPrimitives > n) {
+                rebuildAll();
+                stats.fullRebuild = true;
+                stats.rebuiltSubtrees = 1;
+                stats.rebuiltPrimitives = n;
+            }
+            else {
+                rebuildSubtrees(degraded);
+                stats.rebuiltSubtrees = int(degraded.size());
+                stats.rebuiltPrimitives = degradedPrimitives;
+            }
+        }
+        stats.costRatio = nodes->empty() ? 1.0f : cost[0] / builtCost[0];
+        auto end = std::chrono::high_resolution_clock::now();
+        stats.ms = std::chrono::duration<float, std::milli>(end - start).count();
+        return stats;
+    }
+
+    // Valid until the next update(); the arrays are shared, not copied.
+    const LinearBVH& getBVH() const { return bvh; }
+
+private:
+    int n = 0;
+    int maxLeafSize = 8;
+    SplitMethod splitMethod = SplitMethod::SAH;
+    thread_pool* pool = nullptr;
+    int leafWidth = 1;
+    int treeCount = 0;  // Primitives in the tree, the oversized ones follow in primIndices
+
+    std::vector<BVHPrimitiveInfo> info;
+    std::shared_ptr<std::vector<LinearBVHNode>> nodes = std::make_shared<std::vector<LinearBVHNode>>();
+    std::shared_ptr<std::vector<int>> primIndices = std::make_shared<std::vector<int>>();
+    std::vector<float> cost;        // Per node: subtree SAH cost over its surface area
+    std::vector<float> builtCost;   // The same when the subtree was built
+    LinearBVH bvh;
+
+    static float surfaceArea(const Bounds3& b) { return std::max(b.SurfaceArea(), 1e-20f); }
+
+    void publish() {
+        bvh.nodes = bvh_array<LinearBVHNode>(nodes, nodes->data(), nodes->size());
+        bvh.primIndices = bvh_array<int>(primIndices, primIndices->data(), primIndices->size());
+        bvh.oversizedOffset = treeCount;
+        bvh.oversizedCount = n - treeCount;
+    }
+
+    // Children come after their parent, so one backward sweep sees both
+    // children of a node before the node itself.
+    void refit() {
+        LinearBVHNode* node = nodes->data();
+        const int* prims = primIndices->data();
+        cost.resize(nodes->size());
+        for (int i = int(nodes->size()) - 1; i >= 0; --i) {
+            LinearBVHNode& current = node[i];
+            if (current.nPrimitives > 0) {
+                Bounds3 b;
+                for (int k = current.primitivesOffset; k < current.primitivesOffset + current.nPrimitives; ++k)
+                    b = uni(b, info[prims[k]].bounds);
+                current.bounds = b;
+                cost[i] = LeafCost(current.nPrimitives, leafWidth);
+            }
+            else {
+                const Bounds3& left = node[i + 1].bounds;
+                const Bounds3& right = node[current.secondChildOffset].bounds;
+                current.bounds = uni(left, right);
+                cost[i] = SAH_TRAVERSAL_COST + (surfaceArea(left) * cost[i + 1]
+                    + surfaceArea(right) * cost[current.secondChildOffset]) / surfaceArea(current.bounds);
+            }
+        }
+    }
+
+    // Highest degraded subtrees. Every node down to minRebuildPrimitives is
+    // looked at: a large sibling (the ground sphere, say) can hide a degraded
+    // subtree in its parent's cost.
+    void findDegraded(int i, std::vector<int>& found, int& primitives) const {
+        const LinearBVHNode& node = (*nodes)[i];
+        if (node.nPrimitives > 0)
+            return;
+        int count = primitiveCount(i);
+        if (count < minRebuildPrimitives)
+            return;
+        if (cost[i] > rebuildThreshold * builtCost[i]) {
+            found.push_back(i);
+            primitives += count;
+            return;
+        }
+        findDegraded(i + 1, found, primitives);
+        findDegraded(node.secondChildOffset, found, primitives);
+    }
+
+    // A subtree's leaves cover one contiguous range of primIndices.
+    int firstPrimitive(int i) const {
+        while ((*nodes)[i].nPrimitives == 0) i = i + 1;
+        return (*nodes)[i].primitivesOffset;
+    }
+    int subtreeEnd(int i) const {
+        while ((*nodes)[i].nPrimitives == 0) i = (*nodes)[i].secondChildOffset;
+        return i + 1;
+    }
+    int primitiveCount(int i) const {
+        const LinearBVHNode& last = (*nodes)[subtreeEnd(i) - 1];
+        return last.primitivesOffset + last.nPrimitives - firstPrimitive(i);
+    }
+
+    // Oversized primitives are picked again on every full rebuild and stay
+    // out of the tree until the next one.
+    void rebuildAll() {
+        primIndices->resize(n);
+        std::iota(primIndices->begin(), primIndices->end(), 0);
+        treeCount = PartitionOversized(info, *primIndices);
+        *nodes = BuildFlatBVH(info, *primIndices, 0, treeCount, maxLeafSize, splitMethod, pool, leafWidth);
+        refit();
+        builtCost = cost;
+        publish();
+    }
+
+    // Rebuilds the given disjoint subtrees (in node order) over their own
+    // primitive ranges and splices the new nodes into the array in one pass.
+    void rebuildSubtrees(const std::vector<int>& roots) {
+        const std::vector<LinearBVHNode>& old = *nodes;
+        std::vector<std::vector<LinearBVHNode>> rebuilt(roots.size());
+        std::vector<int> ends(roots.size());
+        for (size_t r = 0; r < roots.size(); ++r) {
+            int first = firstPrimitive(roots[r]);
+            rebuilt[r] = BuildFlatBVH(info, *primIndices, first, first + primitiveCount(roots[r]), maxLeafSize,
+                splitMethod, pool, leafWidth);
+            ends[r] = subtreeEnd(roots[r]);
+        }
+
+        std::vector<LinearBVHNode> spliced;
+        std::vector<float> splicedBuilt;
+        std::vector<int> newIndex(old.size(), -1);  // Kept nodes and replaced subtree roots
+        spliced.reserve(old.size());
+        splicedBuilt.reserve(old.size());
+        size_t r = 0;
+        for (int i = 0; i < int(old.size());) {
+            if (r < roots.size() && i == roots[r]) {
+                int base = int(spliced.size());
+                newIndex[i] = base;
+                for (LinearBVHNode node : rebuilt[r]) {
+                    if (node.nPrimitives == 0)
+                        node.secondChildOffset += base;
+                    spliced.push_back(node);
+                }
+                splicedBuilt.resize(spliced.size(), 0.0f);  // Filled in after the refit below
+                i = ends[r++];
+            }
+            else {
+                newIndex[i] = int(spliced.size());
+                spliced.push_back(old[i]);
+                splicedBuilt.push_back(builtCost[i]);
+                ++i;
+            }
+        }
+        r = 0;
+        for (int i = 0; i < int(old.size()); ++i) {
+            if (r < roots.size() && i == roots[r]) {
+                i = ends[r++] - 1;
+                continue;
+            }
+            if (old[i].nPrimitives == 0)
+                spliced[newIndex[i]].secondChildOffset = newIndex[old[i].secondChildOffset];
+        }
+
+        *nodes = std::move(spliced);
+        refit();
+        // The new subtrees start from their fresh cost, the rest keep theirs
+        for (size_t k = 0; k < roots.size(); ++k) {
+            int begin = newIndex[roots[k]];
+            int end = begin + int(rebuilt[k].size());
+            for (int i = begin; i < end; ++i)
+                splicedBuilt[i] = cost[i];
+        }
+        builtCost = std::move(splicedBuilt);
+        publish();
+    }
+};
+
+#endif
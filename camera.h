@@ -2,39 +2,154 @@
 #define CAMERA_H
 
 #include "hittable.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 #include "material.h"
+#include "thread_pool.h"
+#include "wavefront.h"
+#include "raypacket.h"
+#include "accelerator.h"
+#include "checkpoint.h"
+#include "image_output.h"
 class camera {
 public:
     float aspect_ratio = 1.0;  // Ratio of image width over height
     int    image_width = 100;  // Rendered image width in pixel count
     int    samples_per_pixel = 10;   // Count of random samples for each pixel
     float vfov = 90;  // Vertical view angle (field of view)
-    float RR_rate;//ray dis rate
+    float RR_rate = 0.85f;//ray dis rate, upper bound of the Russian roulette survival probability
+    int    max_depth = 50;     // Maximum number of bounces per path
+    int    rr_min_depth = 3;   // Bounces traced before Russian roulette may end a path
     point3 lookfrom = point3(0, 0, 0);   // Point camera is looking from
     point3 lookat = point3(0, 0, -1);  // Point camera is looking at
     vec3   up = vec3(0, 1, 0);     // Camera-relative "up" direction
-    BVHNode* node;
-    int objectNum;
+    const accelerator* accel = nullptr;  // The scene's acceleration structure, nullptr = world.hit on every ray
+    int    thread_count = 0;  // Render threads, 0 = one per hardware thread, 1 = serial
+    thread_pool* pool = nullptr;  // Render on this pool instead of starting one per render(), e.g. across frames
+    int    tile_size = 32;    // Edge length of the square pixel tiles handed to the workers
+    unsigned int seed = 0;    // Image only depends on this seed, never on thread_count
+    bool   wavefront = false; // Trace each tile as waves of paths shaded per material type
+    int    wave_size = 1 << 16;  // Upper bound of the paths in flight per wave
+    bool   packets = false;   // Trace primary rays in SIMD packets of RAY_PACKET_SIZE samples
+    bool   adaptive = false;  // samples_per_pixel becomes an average: converged pixels stop early, noisy ones get more
+    float  adaptive_threshold = 0.01f;  // 95% confidence half-width a pixel must reach, in displayed (gamma) units
+    int    adaptive_min_samples = 16;   // Samples every pixel gets before its variance is trusted, at most samples_per_pixel
+    int    adaptive_max_samples = 0;    // Per pixel cap, 0 = 4 * samples_per_pixel
+    int    adaptive_batch = 16;         // Samples added to every unconverged pixel per pass
+    std::string sample_map = "samples.pgm";  // Sample count of every pixel after an adaptive render, empty = none
+    bool   progressive = false;  // Render in passes of progressive_samples per pixel, accumulated in floats
+    int    progressive_samples = 16;
+    std::string checkpoint_file;    // Progressive/adaptive renders save here and resume from it, empty = off
+    float  checkpoint_seconds = 60; // Minimum time between two checkpoints
+    std::string output_file = "output.ppm";  // Empty = render without writing an image
+    image_format output_format = image_format::ppm;  // Binary P6, text P3 or linear float PFM
+
+    // What the last render() traced, for benchmarks.
+    struct render_stats {
+        double   render_ms = 0;        // Tracing only, without output
+        uint64_t camera_rays = 0;      // One per sample
+        uint64_t secondary_rays = 0;   // Scattered rays after the first hit
+    };
+    render_stats last_render;
+#ifdef RT_STATS
+    std::string heatmap_file = "traversal_cost.ppm";  // Per pixel traversal cost, empty = none
+#endif
+
+    // Sets the view up as render() does, without rendering, and returns the
+    // image height. Tools then replay the renderer's rays with sample_ray().
+    int prepare() {
+        initialize();
+        return image_height;
+    }
+
+    // Camera ray of sample s of pixel (x, y), seeded as render() seeds it
+    ray sample_ray(int x, int y, int s) const {
+        seed_random(seed, uint32_t(y) * uint32_t(image_width) + uint32_t(x), uint32_t(s), 0);
+        return get_ray(x, y);
+    }
+
     void render(const hittable& world) {
         initialize();
-        std::ofstream file("output.ppm");
-        file << "P3\n" << image_width << " " << image_height << "\n255\n";  // ͷдļ
-
-        for (int y = 0; y < image_height; ++y) {
-            std::cout << "\rScanlines remaining: " << (image_height - y) << ' ' << std::flush;
-            for (int x = 0; x < image_width; ++x) {
-                color pixel_color(0, 0, 0);
-                //ز
-                for (int s = 0; s < samples_per_pixel; ++s) {
-                    ray r = get_ray(x, y);  // ȷ˺ȷʵ
-                    pixel_color += ray_color(r, world);
+
+        // One pool for the whole render, pass based modes sweep the tiles several times.
+        std::unique_ptr<thread_pool> own_pool;
+        if (!pool && thread_count != 1)
+            own_pool = std::make_unique<thread_pool>(thread_count);
+        thread_pool* workers = pool ? pool : own_pool.get();
+
+        // Tiles are rendered in any order into the shared framebuffer, every
+        // pixel owns its own slot so no locking is needed.
+        std::vector<color> framebuffer(size_t(image_width) * image_height);
+
+        // ƸʽļմСӳ䵽ڴ棬Ⱦ tile ֱתдȥ
+        image_writer out;
+        if (!output_file.empty() && output_format != image_format::ppm_ascii
+            && !out.open(output_file, output_format, image_width, image_height))
+            std::cerr << "Cannot create " << output_file << "\n";
+
+        traced_camera_rays = 0;
+        traced_secondary_rays = 0;
+#ifdef RT_STATS
+        stats_counters().reset();
+        traversal_cost.assign(framebuffer.size(), 0);
+#endif
+        auto render_start = std::chrono::steady_clock::now();
+
+        if (adaptive || progressive) {
+            // ÿصͬ׷٣ wavefront
+            render_passes(world, workers, framebuffer);
+            out.write_tile(framebuffer, 0, 0, image_width, image_height);
+        }
+        else {
+            int tiles = tile_count();
+            std::atomic<int> tiles_done(0);
+            std::mutex progress_mutex;
+
+            for_each_tile(workers, [&](int x0, int y0, int x1, int y1) {
+                if (wavefront) {
+                    render_tile_wavefront(x0, y0, x1, y1, world, framebuffer);
                 }
-                write_color(file, pixel_color* pixel_samples_scale);  // 
-            }
+                else {
+                    for (int y = y0; y < y1; ++y)
+                        for (int x = x0; x < x1; ++x)
+                            framebuffer[size_t(y) * image_width + x] = render_pixel(x, y, world);
+                }
+                out.write_tile(framebuffer, x0, y0, x1, y1);
+
+                int done = ++tiles_done;
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                std::cout << "\rTiles remaining: " << (tiles - done) << "    " << std::flush;
+            });
+        }
+
+        last_render.render_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - render_start).count();
+        last_render.camera_rays = traced_camera_rays;
+        last_render.secondary_rays = traced_secondary_rays;
+
+        if (!output_file.empty() && output_format == image_format::ppm_ascii) {
+            std::ofstream file(output_file);
+            file << "P3\n" << image_width << " " << image_height << "\n255\n";  // ͷдļ
+
+            for (const auto& pixel_color : framebuffer)
+                write_color(file, pixel_color);
         }
+        out.close();
+        // ͼѾд꣬ϵû
+        if ((adaptive || progressive) && !checkpoint_file.empty())
+            std::remove(checkpoint_file.c_str());
         std::cout << "\rDone.\n";
+#ifdef RT_STATS
+        print_stats_report(std::cout, stats_counters().collect());
+        if (!heatmap_file.empty())
+            write_heatmap();
+#endif
     }
 
 
@@ -46,6 +161,40 @@ private:
     vec3   pixel_delta_u;  // Offset to pixel to the right
     vec3   pixel_delta_v;  // Offset to pixel below
     vec3   u, v, w;              // Camera frame basis vectors
+#ifdef RT_STATS
+    static_assert(material_type_count == STATS_MATERIAL_TYPES, "stats.h counts hits per material type");
+    mutable std::vector<uint64_t> traversal_cost;  // Box and primitive tests spent on each pixel
+#endif
+    mutable std::atomic<uint64_t> traced_camera_rays{ 0 };
+    mutable std::atomic<uint64_t> traced_secondary_rays{ 0 };
+
+    // Rays traced by the calling thread. Workers count without synchronization
+    // and for_each_tile adds what each tile traced to the totals.
+    struct ray_counts {
+        uint64_t camera = 0;
+        uint64_t secondary = 0;
+    };
+    static ray_counts& thread_rays() {
+        thread_local ray_counts counts;
+        return counts;
+    }
+
+    // Running sums of one pixel: the color for the estimate, its luminance for the variance.
+    struct pixel_stats {
+        color sum = color(0, 0, 0);
+        double lum_sum = 0;
+        double lum_sq = 0;
+        int n = 0;
+
+        void add(const color& c) {
+            sum += c;
+            double y = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+            lum_sum += y;
+            lum_sq += y * y;
+            ++n;
+        }
+    };
+
     void initialize() {
         image_height = int(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
@@ -78,6 +227,232 @@ private:
             center - focal_length*w - viewport_u / 2 - viewport_v / 2;
         pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
     }
+    int tile_count() const {
+        return ((image_width + tile_size - 1) / tile_size) * ((image_height + tile_size - 1) / tile_size);
+    }
+
+    // Calls f(x0, y0, x1, y1) once per tile, on the pool when there is one.
+    template <class F>
+    void for_each_tile(thread_pool* pool, F&& f) const {
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        auto run = [&](int tile) {
+            int x0 = (tile % tiles_x) * tile_size;
+            int y0 = (tile / tiles_x) * tile_size;
+            ray_counts before = thread_rays();
+            f(x0, y0, std::min(x0 + tile_size, image_width), std::min(y0 + tile_size, image_height));
+            traced_camera_rays += thread_rays().camera - before.camera;
+            traced_secondary_rays += thread_rays().secondary - before.secondary;
+        };
+        if (pool) {
+            pool->parallel_for(tile_count(), run);
+        }
+        else {
+            for (int tile = 0; tile < tile_count(); ++tile)
+                run(tile);
+        }
+    }
+
+    color render_pixel(int x, int y, const hittable& world) const {
+        pixel_stats stats;
+        render_samples(x, y, 0, samples_per_pixel, world, stats);
+        return stats.sum * pixel_samples_scale;
+    }
+
+    // Traces samples s0 .. s1 - 1 of pixel (x, y) into stats.
+    void render_samples(int x, int y, int s0, int s1, const hittable& world, pixel_stats& stats) const {
+        // Every sample and bounce reseeds the generator from its own counters, so
+        // the result is independent of which thread renders the pixel and when,
+        // and of how many passes the samples are split into.
+        uint32_t pixel = uint32_t(y) * uint32_t(image_width) + uint32_t(x);
+        STAT_COST_SCOPE(traversal_cost[pixel]);
+
+        if (packets && accel && accel->hasTree()) {
+            // The samples of one pixel form very coherent packets. Only the first
+            // hit is traced as a packet, the bounces diverge and go on as single rays.
+            ray_packet packet;
+            hit_record recs[RAY_PACKET_SIZE];
+            for (int first = s0; first < s1; first += RAY_PACKET_SIZE) {
+                int lanes = std::min(RAY_PACKET_SIZE, s1 - first);
+                packet = ray_packet();
+                for (int lane = 0; lane < lanes; ++lane) {
+                    seed_random(seed, pixel, first + lane, 0);
+                    packet.set(lane, get_ray(x, y));
+                }
+                int hits = accel->hitPacket(packet, recs);
+                thread_rays().camera += lanes;
+                for (int lane = 0; lane < lanes; ++lane)
+                    stats.add(trace_path(packet.rays[lane], recs[lane], (hits >> lane) & 1, world, pixel, first + lane));
+            }
+            return;
+        }
+
+        for (int s = s0; s < s1; ++s) {
+            seed_random(seed, pixel, s, 0);
+            ray r = get_ray(x, y);
+            thread_rays().camera += 1;
+            stats.add(ray_color(r, world, pixel, s));
+        }
+    }
+
+    // Ⱦÿһָһزۼ float  pixel_stats 
+    // progressive ģʽÿָز progressive_samples adaptive ģʽֻûġ
+    //  checkpoint_file ʱÿ checkpoint_seconds ԭӵдһζϵ㣬ʱӶϵ
+    // ֻ (seed, , , ) ϵÿص
+    // ȫ״ֵ̬Ľһλͬ
+    void render_passes(const hittable& world, thread_pool* pool, std::vector<color>& framebuffer) const {
+        size_t pixel_count = framebuffer.size();
+        std::vector<pixel_stats> stats(pixel_count);
+        std::vector<int> target(pixel_count);
+
+        checkpoint_header header = make_checkpoint_header(sizeof(pixel_stats), image_width, image_height,
+            settings_key(pool), 0);
+        if (!checkpoint_file.empty()) {
+            if (read_checkpoint(checkpoint_file, header, stats.data()))
+                std::cout << "Resumed from " << checkpoint_file << ": " << header.samples << " samples\n";
+            else
+                stats.assign(pixel_count, pixel_stats());
+        }
+
+        auto last_save = std::chrono::steady_clock::now();
+        for (int pass = 1; ; ++pass) {
+            if (!(adaptive ? next_adaptive_pass(stats, target, pass) : next_uniform_pass(stats, target, pass)))
+                break;
+            for_each_tile(pool, [&](int x0, int y0, int x1, int y1) {
+                for (int y = y0; y < y1; ++y) {
+                    for (int x = x0; x < x1; ++x) {
+                        size_t i = size_t(y) * image_width + x;
+                        if (stats[i].n < target[i])
+                            render_samples(x, y, stats[i].n, target[i], world, stats[i]);
+                    }
+                }
+            });
+
+            auto now = std::chrono::steady_clock::now();
+            if (!checkpoint_file.empty() && std::chrono::duration<float>(now - last_save).count() >= checkpoint_seconds) {
+                header.samples = total_samples(stats);
+                if (!write_checkpoint(checkpoint_file, header, stats.data()))
+                    std::cerr << "\nCannot write checkpoint " << checkpoint_file << "\n";
+                last_save = now;
+            }
+        }
+
+        long long spent = total_samples(stats);
+        for (size_t i = 0; i < pixel_count; ++i)
+            framebuffer[i] = stats[i].sum * (1.0f / std::max(stats[i].n, 1));
+        std::cout << "\r" << spent << " samples, " << double(spent) / pixel_count
+            << " per pixel (budget " << samples_per_pixel << ")" << std::string(16, ' ') << "\n";
+
+        if (adaptive && !sample_map.empty()) {
+            // PGM Ҷͼֵ
+            int most = 1;
+            for (const auto& st : stats)
+                most = std::max(most, std::min(st.n, 65535));
+            std::ofstream map(sample_map);
+            map << "P2\n" << image_width << " " << image_height << "\n" << most << "\n";
+            for (size_t i = 0; i < pixel_count; ++i)
+                map << std::min(stats[i].n, 65535) << ((i + 1) % image_width ? ' ' : '\n');
+        }
+    }
+
+    static long long total_samples(const std::vector<pixel_stats>& stats) {
+        long long total = 0;
+        for (const auto& st : stats)
+            total += st.n;
+        return total;
+    }
+
+    // ȷ֣ÿز min(n + progressive_samples, samples_per_pixel)
+    bool next_uniform_pass(const std::vector<pixel_stats>& stats, std::vector<int>& target, int pass) const {
+        bool more = false;
+        int fewest = samples_per_pixel;
+        for (size_t i = 0; i < stats.size(); ++i) {
+            target[i] = std::max(stats[i].n, std::min(stats[i].n + std::max(1, progressive_samples), samples_per_pixel));
+            more |= target[i] > stats[i].n;
+            fewest = std::min(fewest, stats[i].n);
+        }
+        std::cout << "\rPass " << pass << ": " << fewest << "/" << samples_per_pixel << " samples per pixel    "
+            << std::flush;
+        return more;
+    }
+
+    // Ӧȸÿ adaptive_min_samples ֮ÿһֻ
+    // 仹̫ز adaptive_batch 
+    // samples_per_pixel * յʡµԤ
+    // ģأ adaptive_max_samples 
+    // ÿֽͳһһ֣ͬ߳޹
+    bool next_adaptive_pass(const std::vector<pixel_stats>& stats, std::vector<int>& target, int pass) const {
+        size_t pixel_count = stats.size();
+        int max_samples = adaptive_max_samples > 0 ? adaptive_max_samples : 4 * samples_per_pixel;
+        // ԤȲԤ㣺samples_per_pixel С adaptive_min_samples ʱÿֻ samples_per_pixel 
+        int first = std::max(1, std::min({ adaptive_min_samples, max_samples, samples_per_pixel }));
+
+        bool warming_up = false;
+        for (size_t i = 0; i < pixel_count; ++i) {
+            target[i] = std::max(stats[i].n, first);
+            warming_up |= target[i] > stats[i].n;
+        }
+        if (warming_up)
+            return true;
+
+        std::vector<size_t> unconverged;
+        for (size_t i = 0; i < pixel_count; ++i) {
+            if (stats[i].n < max_samples && !converged(stats, int(i % image_width), int(i / image_width)))
+                unconverged.push_back(i);
+        }
+        std::cout << "\rAdaptive pass " << pass << ": " << unconverged.size() << " pixels unconverged    "
+            << std::flush;
+
+        // ʣԤ㲻ÿδزһʱֹͣ
+        long long left = (long long)samples_per_pixel * (long long)pixel_count - total_samples(stats);
+        int batch = unconverged.empty() ? 0
+            : int(std::min<long long>(std::max(1, adaptive_batch), left / (long long)unconverged.size()));
+        if (batch <= 0)
+            return false;
+        for (size_t i : unconverged)
+            target[i] = std::min(stats[i].n + batch, max_samples);
+        return true;
+    }
+
+    // ϵֻͬһúͬһ֣ЩκһͼԪİΧ
+    // ʲˣͬһֵͱ
+    uint64_t settings_key(thread_pool* pool) const {
+        uint64_t key = mix64(seed ^ (accel ? accel->sceneKey(pool) : 0));
+        auto add = [&key](float v) {
+            uint32_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            key = mix64(key ^ bits);
+        };
+        for (float v : { float(image_width), float(image_height), vfov, RR_rate, float(max_depth), float(rr_min_depth),
+            float(accel ? accel->size() : 0), lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(), lookat.z(),
+            up.x(), up.y(), up.z() })
+            add(v);
+        return key;
+    }
+
+    //  3x3 ϲƷصȫֻͬ
+    // Եһ㣩ϲԵΧػ
+    // ԼľֵģԼ㣬ϲġ
+    // 95% İȣ㵽 gamma 2 ֮ʾֵd sqrt(L) = dL / (2 sqrt(L))
+    bool converged(const std::vector<pixel_stats>& stats, int x, int y) const {
+        double sum = 0, sq = 0;
+        int n = 0;
+        for (int j = std::max(y - 1, 0); j <= std::min(y + 1, image_height - 1); ++j) {
+            for (int i = std::max(x - 1, 0); i <= std::min(x + 1, image_width - 1); ++i) {
+                const pixel_stats& st = stats[size_t(j) * image_width + i];
+                sum += st.lum_sum;
+                sq += st.lum_sq;
+                n += st.n;
+            }
+        }
+        int own_n = stats[size_t(y) * image_width + x].n;
+        if (n < 2 || own_n < 1)
+            return false;
+        double mean = sum / n;
+        double variance = std::max(0.0, (sq - sum * mean) / (n - 1));
+        double half_width = 1.96 * std::sqrt(variance / own_n);
+        return half_width <= adaptive_threshold * 2.0 * std::sqrt(std::max(mean, 1e-4));
+    }
+
     ray get_ray(int i, int j) const {
         // Construct a camera ray originating from the origin and directed at randomly sampled
         // point around the pixel location i, j.
@@ -97,58 +472,199 @@ private:
         // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
         return vec3(random_double() - 0.5, random_double() - 0.5, 0);
     }
-    color ray_color(const ray& r, const hittable& world) {
+    // ʽ·׷٣ throughput ¼·ۼƵ˥ٵݹ飬ջȹ̶
+    color ray_color(const ray& r, const hittable& world, uint32_t pixel, uint32_t sample) const {
+        if (max_depth < 1)
+            return color(0, 0, 0);
+        hit_record rec;
+        bool hit = intersection(r, rec, world);
+        return trace_path(r, rec, hit, world, pixel, sample);
+    }
+
+    // һѾhit / rec׷·
+    color trace_path(ray r, hit_record& rec, bool hit, const hittable& world, uint32_t pixel, uint32_t sample) const {
+        color throughput(1, 1, 1);
+        for (int depth = 1; ; ++depth) {
+            // ûлʱرɫ
+            if (!hit) {
+                STAT_INC(escaped);
+                STAT_PATH(depth);
+                return throughput * background(r);
+            }
+            if (!continue_path(r, rec, pixel, sample, depth, throughput, r)) {
+                STAT_PATH(depth);
+                return color(0, 0, 0);
+            }
+            // ȣ
+            if (depth >= max_depth) {
+                STAT_INC(maxDepthReached);
+                STAT_PATH(depth);
+                return color(0, 0, 0);
+            }
+            thread_rays().secondary += 1;
+            hit = intersection(r, rec, world);
+        }
+    }
 
+    // ڽ㴦ɢһΣ throughput дһιߣ false ʾ·Ϊɫ
+    // ·ͲǰȾһ֤߽λһ
+    bool continue_path(const ray& r, const hit_record& rec, uint32_t pixel, uint32_t sample, int depth,
+        color& throughput, ray& next) const {
+        seed_random(seed, pixel, sample, depth);
+        STAT_INC(materialHits[int(rec.mat->kind)]);
 
+        //  ߻嵫գ·
+        ray scattered;
+        color attenuation;
+        if (!scatter_material(*rec.mat, r, rec, attenuation, scattered)) {
+            STAT_INC(absorbed);
+            return false;
+        }
+        throughput = throughput * attenuation;
 
-        hit_record rec;
-        BVHNode* head = node;
+        //㾫⣺ƫɢߵԭԱཻ
+        next = ray(rec.p + rec.normal * 0.001f, scattered.direction()); // ط߷΢Сƫ
 
-        // ȼ볡Ľ
-        if (intersection(head, r, rec, world)) {
-            ray scattered;
-            color attenuation;
+        // ӦRRǷ׷٣ǰ rr_min_depth ε䲻ʲ RR_rate
+        float continue_probability = std::max(throughput.x(), std::max(throughput.y(), throughput.z()));
+        if (continue_probability <= 0) {
+            STAT_INC(absorbed);
+            return false;
+        }
+        if (depth >= rr_min_depth) {
+            continue_probability = std::min(RR_rate, continue_probability);
+            if (random_double() >= continue_probability) {
+                STAT_INC(rouletteKilled);
+                return false; // ֹغɫ
+            }
+            throughput /= continue_probability;
+        }
+        return true;
+    }
 
-            //  ߻壬ɢ䣨練䣩
-            if (rec.mat->scatter(r, rec, attenuation, scattered)) {
+    // ǰȾһ tile ءɸһ·󽻺
+    // ͷɫٽһε
+    void render_tile_wavefront(int x0, int y0, int x1, int y1, const hittable& world,
+        std::vector<color>& framebuffer) const {
+        int width = x1 - x0;
+        int tile_pixels = width * (y1 - y0);
+        int samples_per_wave = std::max(1, std::min(samples_per_pixel, wave_size / tile_pixels));
 
-                //㾫⣺ƫɢߵԭԱཻ
-                vec3 offset_origin = rec.p + rec.normal * 0.001f; // ط߷΢Сƫ
-                ray offset_scattered(offset_origin, scattered.direction());
+        path_batch batch;
+        batch.resize(tile_pixels * samples_per_wave);
+        std::vector<color> sums(tile_pixels, color(0, 0, 0));
+        std::vector<int> hit_paths;
+        hit_paths.reserve(batch.size());
 
-                // ӦRRǷ׷
-                double continue_probability = std::max(attenuation.x(), std::max(attenuation.y(), attenuation.z()));
-                continue_probability = std::min(1.0, continue_probability); // ȷʲ1
+        for (int s0 = 0; s0 < samples_per_pixel; s0 += samples_per_wave) {
+            int s1 = std::min(s0 + samples_per_wave, samples_per_pixel);
+            int wave_samples = s1 - s0;
 
-                if (random_double() < continue_probability) {
-                   
-                    color recursive_color = ray_color(offset_scattered, world);
-                    return attenuation * recursive_color / continue_probability;
+            // ߣͬһص·ڴţ˳ۼ
+            batch.active.clear();
+            for (int p = 0; p < tile_pixels; ++p) {
+                int x = x0 + p % width;
+                int y = y0 + p / width;
+                uint32_t pixel = uint32_t(y) * uint32_t(image_width) + uint32_t(x);
+                for (int s = s0; s < s1; ++s) {
+                    int i = p * wave_samples + (s - s0);
+                    seed_random(seed, pixel, s, 0);
+                    batch.set_ray(i, get_ray(x, y));
+                    batch.set_throughput(i, color(1, 1, 1));
+                    batch.finish(i, color(0, 0, 0));
+                    batch.pixel[i] = pixel;
+                    batch.sample[i] = s;
+                    batch.active.push_back(i);
                 }
-                else {
-                    // ֹغɫ
-                    return color(0, 0, 0);
+            }
+
+            for (int depth = 1; depth <= max_depth && !batch.active.empty(); ++depth) {
+                // 󽻣δе·ֱȡɫ
+                if (depth == 1)
+                    thread_rays().camera += batch.active.size();
+                else
+                    thread_rays().secondary += batch.active.size();
+                hit_paths.clear();
+                for (int i : batch.active) {
+                    STAT_COST_SCOPE(traversal_cost[batch.pixel[i]]);
+                    ray r = batch.get_ray(i);
+                    if (intersection(r, batch.hits[i], world)) {
+                        hit_paths.push_back(i);
+                    }
+                    else {
+                        STAT_INC(escaped);
+                        STAT_PATH(depth);
+                        batch.finish(i, batch.throughput(i) * background(r));
+                    }
+                }
+
+                // ͷ飬ÿһѭɫ
+                batch.sort_by_material(hit_paths);
+                batch.active.clear();
+                for (int k = 0; k < material_type_count; ++k) {
+                    for (int j = batch.bin_start[k]; j < batch.bin_start[k + 1]; ++j) {
+                        int i = batch.shading[j];
+                        color throughput = batch.throughput(i);
+                        ray next;
+                        if (continue_path(batch.get_ray(i), batch.hits[i], batch.pixel[i], batch.sample[i],
+                            depth, throughput, next)) {
+                            batch.set_ray(i, next);
+                            batch.set_throughput(i, throughput);
+                            batch.active.push_back(i);
+                        }
+                        else {
+                            STAT_PATH(depth);
+                        }
+                    }
                 }
             }
-            else {
-          
-                return color(0, 0, 0);
+#ifdef RT_STATS
+            // ׷ٵ·
+            for (size_t j = 0; j < batch.active.size(); ++j) {
+                STAT_INC(maxDepthReached);
+                STAT_PATH(max_depth);
             }
+#endif
+
+            for (int p = 0; p < tile_pixels; ++p)
+                for (int i = p * wave_samples; i < (p + 1) * wave_samples; ++i)
+                    sums[p] += color(batch.lr[i], batch.lg[i], batch.lb[i]);
         }
+
+        for (int p = 0; p < tile_pixels; ++p)
+            framebuffer[size_t(y0 + p / width) * image_width + x0 + p % width] = sums[p] * pixel_samples_scale;
+    }
+
+#ifdef RT_STATS
+    // ͼ 99% λһ ->  ->  -> 
+    void write_heatmap() const {
+        std::vector<uint64_t> sorted(traversal_cost);
+        size_t p99 = sorted.empty() ? 0 : sorted.size() * 99 / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+        double scale = std::max<uint64_t>(sorted.empty() ? 1 : sorted[p99], 1);
+
+        std::ofstream map(heatmap_file, std::ios::binary);
+        map << "P6\n" << image_width << " " << image_height << "\n255\n";
+        for (uint64_t cost : traversal_cost) {
+            double t = std::min(cost / scale, 1.0);
+            auto channel = [t](double center) {
+                return (unsigned char)(255 * std::max(0.0, std::min(1.0, 1.5 - std::fabs(4 * t - center))));
+            };
+            unsigned char rgb[3] = { channel(3), channel(2), channel(1) };
+            map.write(reinterpret_cast<const char*>(rgb), 3);
+        }
+        std::cout << "Traversal cost heatmap " << heatmap_file << ": red = " << scale << " tests per pixel or more\n";
+    }
+#endif
+
+    color background(const ray& r) const {
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5 * (unit_direction.y() + 1.0);
         return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
     }
-    bool intersection(BVHNode* head, const ray& ray, hit_record& rec, const hittable& world) {
-        
-        if (objectNum>50) {
-          return  BVHIntersect(head, ray, rec);
-        }
-        else {
-            
-             return world.hit(ray,interval(0.001, infinity),rec);
-            
-        }
+    bool intersection(const ray& ray, hit_record& rec, const hittable& world) const {
+        if (accel) return accel->hit(ray, rec);
+        return world.hit(ray, interval(0.001, infinity), rec);
     }
 };
 
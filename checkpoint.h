@@ -0,0 +1,101 @@
+#pragma once
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Render checkpoints: a small header followed by one fixed size record per
+// pixel. The file is written next to the target and renamed over it, so a job
+// killed at any moment leaves either the previous checkpoint or the new one,
+// never a torn file.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+struct checkpoint_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;   // Bytes per pixel record, catches layout changes
+    uint32_t width;
+    uint32_t height;
+    uint64_t key;           // Hash of every setting that changes the value of a sample
+    uint64_t samples;       // Total samples stored, informational
+};
+
+const char CHECKPOINT_MAGIC[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0' };
+const uint32_t CHECKPOINT_VERSION = 1;
+
+// Atomically replaces `to` with `from`. std::rename does not overwrite on Windows.
+inline bool replace_file(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+inline checkpoint_header make_checkpoint_header(uint32_t record_size, uint32_t width, uint32_t height,
+    uint64_t key, uint64_t samples) {
+    checkpoint_header h;
+    std::memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.record_size = record_size;
+    h.width = width;
+    h.height = height;
+    h.key = key;
+    h.samples = samples;
+    return h;
+}
+
+inline bool write_checkpoint(const std::string& path, const checkpoint_header& header, const void* records) {
+    std::string tmp = path + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    size_t bytes = size_t(header.record_size) * header.width * header.height;
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+        && std::fwrite(records, 1, bytes, f) == bytes
+        && std::fflush(f) == 0;
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || !replace_file(tmp, path)) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Reads the records of a checkpoint whose header matches `expected` (except for
+// the sample count, which is returned through it). Returns false for a missing,
+// foreign or truncated file; `records` may then be partly overwritten.
+inline bool read_checkpoint(const std::string& path, checkpoint_header& expected, void* records) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    checkpoint_header h;
+    bool ok = std::fread(&h, sizeof(h), 1, f) == 1
+        && std::memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) == 0
+        && h.version == CHECKPOINT_VERSION
+        && h.record_size == expected.record_size
+        && h.width == expected.width
+        && h.height == expected.height
+        && h.key == expected.key;
+    if (ok) {
+        size_t bytes = size_t(h.record_size) * h.width * h.height;
+        ok = std::fread(records, 1, bytes, f) == bytes;
+        expected.samples = h.samples;
+    }
+    std::fclose(f);
+    return ok;
+}
+
+#endif
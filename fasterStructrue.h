@@ -2,7 +2,19 @@
 #include "hittable.h" // ǰ
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "thread_pool.h"
+#include "stats.h"
 class hittable;
+
+// Χ󽻰뿪Ŵ 1+2(3)Ize 2013òӱ߽ǵĹ©塣
+// ˮ񶥵ϵĹڰΧеı߽
+const float BOX_EXIT_SCALE = 1.0f + 2 * 3.0f * 0.5f * FLT_EPSILON / (1 - 3.0f * 0.5f * FLT_EPSILON);
+
 // Bounds3.hpp
 struct Bounds3 {
     vec3 pMin, pMax; // С/󶥵
@@ -12,15 +24,18 @@ struct Bounds3 {
     // ΧбSAHģ
     float SurfaceArea() const {
         vec3 d = pMax - pMin;
-        return 2.0f * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        return 2.0f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
     }
-    inline int maxExtent() {
-        auto temp = std::max(abs(pMax[0] - pMin[0]), std::max(abs(pMax[1] - pMin[1]), abs(pMax[2] - pMin[2])));
-        if (abs(pMax[0] - pMin[0]) == temp)
+    vec3 Centroid() const {
+        return 0.5f * (pMin + pMax);
+    }
+    inline int maxExtent() const {
+        vec3 d = pMax - pMin;
+        if (d[0] >= d[1] && d[0] >= d[2])
         {
             return 0;
         }
-        else if (abs(pMax[1] - pMin[1]) == temp)
+        else if (d[1] >= d[2])
         {
             return 1;
         }
@@ -45,15 +60,31 @@ struct Bounds3 {
         }
         return { tMin, tMax>0 }; // ؽཻ־
     }
+    // õĿٰ汾ͷɵ÷ÿֻһ
+    inline bool IntersectP(const vec3& origin, const vec3& invDir, const int dirIsNeg[3], float tMax) const {
+        // Ϊ0ںƽʱ 0*inf  NaNȽдɺ NaN ʽһ᲻
+        float tEnter = -std::numeric_limits<float>::max();
+        float tExit = std::numeric_limits<float>::max();
+        for (int i = 0; i < 3; ++i) {
+            float t0 = ((dirIsNeg[i] ? pMax : pMin)[i] - origin[i]) * invDir[i];
+            float t1 = ((dirIsNeg[i] ? pMin : pMax)[i] - origin[i]) * invDir[i];
+            if (t0 > tEnter) tEnter = t0;
+            if (t1 < tExit) tExit = t1;
+        }
+        tExit *= BOX_EXIT_SCALE;
+        return tEnter <= tExit && tExit > 0 && tEnter < tMax;
+    }
 };
 
-// BVHڵṹ
+// BVHڵ㣺ֻڹڼڣɺѹƽ LinearBVH
 struct BVHNode {
     Bounds3 bounds;
     BVHNode* left = nullptr;
     BVHNode* right = nullptr;
     bool isLeaf = false;
-    std::vector<std::shared_ptr<hittable>> objects; // Ҷӽڵ洢
+    int splitAxis = 0;
+    int firstPrimOffset = 0; // Ҷӽڵ㣺 primIndices еʼλ
+    int nPrimitives = 0;     // Ҷӽڵ㣺
 // ֹڴй©
     BVHNode(){}
 ~BVHNode() {
@@ -75,188 +106,436 @@ Bounds3 ComputeBbox(const std::vector<std::shared_ptr<hittable>>& objects, int s
     return bbox;
 }
 
-// SAHָѡСɱķָ
+// ѹƽBVHڵ㣬˳ţ32ֽ
+// ڲڵ㣺ӽԼ棬Һ±Ϊ secondChildOffset
+// Ҷӽڵ㣺primIndices[primitivesOffset, primitivesOffset + nPrimitives)
+struct LinearBVHNode {
+    Bounds3 bounds;
+    union {
+        int primitivesOffset;   // Ҷ
+        int secondChildOffset;  // ڲڵ
+    };
+    uint16_t nPrimitives = 0;   // 0 ʾڲڵ
+    uint8_t axis = 0;           // ڲڵĻᣬھȷĸ
+    uint8_t pad = 0;
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should stay 32 bytes");
+
+// õBVHֻһ vector Уӻļصֱָӳڴ棬
+// owner ô洢һ LinearBVH ͷΪֹ LinearBVH ֻ
+template <class T>
+class bvh_array {
+public:
+    bvh_array() = default;
+    explicit bvh_array(std::vector<T>&& items) {
+        auto owned = std::make_shared<std::vector<T>>(std::move(items));
+        first = owned->data();
+        count = owned->size();
+        owner = std::move(owned);
+    }
+    bvh_array(std::shared_ptr<const void> owner, const T* first, size_t count)
+        : owner(std::move(owner)), first(first), count(count) {}
+
+    const T* data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return first[i]; }
+    const T* begin() const { return first; }
+    const T* end() const { return first + count; }
+
+private:
+    std::shared_ptr<const void> owner;
+    const T* first = nullptr;
+    size_t count = 0;
+};
+
+struct LinearBVH {
+    bvh_array<LinearBVHNode> nodes;
+    bvh_array<int> primIndices;  // Ҷõ±꣬
+    const std::vector<std::shared_ptr<hittable>>* objects = nullptr;
+    // ĳ壺primIndices[oversizedOffset, oversizedOffset + oversizedCount)ÿ߱ǰһ
+    int oversizedOffset = 0;
+    int oversizedCount = 0;
+
+    float buildMs = 0;  // ʱ룩
+
+    bool empty() const { return nodes.empty(); }
+    size_t MemoryBytes() const {
+        return nodes.size() * sizeof(LinearBVHNode) + primIndices.size() * sizeof(int);
+    }
+};
+
+// ǰԤÿİΧкģвٵ麯
+struct BVHPrimitiveInfo {
+    Bounds3 bounds;
+    vec3 centroid;
+};
+
+enum class SplitMethod { SAH, Middle };
+
+// 
+const int SAH_BIN_COUNT = 32;          // ռͰ
+const float SAH_TRAVERSAL_COST = 0.125f; // һ󽻵ı
+const int PARALLEL_BUILD_THRESHOLD = 4096; // ̳߳ع
+// 壺ΧбȫİΧе OVERSIZED_AREA_RATIO 
+//  OVERSIZED_MAX_COUNT ٶ˵屾Ͷճ
+const float OVERSIZED_AREA_RATIO = 1.0f;
+const int OVERSIZED_MAX_COUNT = 8;
+
+// Ҷ󽻴ۣleafWidth һSIMD꣨sphere_soup
+inline float LeafCost(int count, int leafWidth) {
+    return float((count + leafWidth - 1) / leafWidth);
+}
+
+// ͰSAHİΧϾȷͰǰ׺/׺ɨõÿָĴۡ
+// ػλã -1 ʾҶӱȻָ
 int FindBestSplitWithSAH(
-    const std::vector<shared_ptr<hittable>>& objects,
-    int start, int end, int axis,
-    float& minCost, float axisLen
+    const std::vector<BVHPrimitiveInfo>& info,
+    std::vector<int>& primIndices,
+    int start, int end,
+    const Bounds3& bbox, const Bounds3& centroidBounds, int axis,
+    int maxLeafSize, int leafWidth
 ) {
-    const int BIN_COUNT = 32; // ռͰ
     struct Bin {
         Bounds3 bbox;
         int count = 0;
-    } bins[BIN_COUNT];
-    // ʼͰ
+    } bins[SAH_BIN_COUNT];
+
+    float cmin = centroidBounds.pMin[axis];
+    float scale = SAH_BIN_COUNT / (centroidBounds.pMax[axis] - cmin);
+    auto binOf = [&](int prim) {
+        int b = int((info[prim].centroid[axis] - cmin) * scale);
+        return std::max(0, std::min(SAH_BIN_COUNT - 1, b));
+    };
 
-    int bestSplit = start + (end - start) / 2; // Ĭλָ
-    float binWidth = axisLen / BIN_COUNT;
-	if (binWidth <= 0.1f) return bestSplit; // ֹ0
-    if (axisLen == 0) return start + (end - start) / 2; // ֹѭ
     // 䵽Ͱ
     for (int i = start; i < end; i++) {
-        float center = objects[i]->getCenter()[axis];
-        int binIdx = std::max(0, std::min(BIN_COUNT - 1, (int)((center - objects[start]->bounding_box().pMin[axis]) / binWidth)));
-        bins[binIdx].bbox = uni(bins[binIdx].bbox, objects[i]->bounding_box());
-        bins[binIdx].count++;
+        Bin& bin = bins[binOf(primIndices[i])];
+        bin.bbox = uni(bin.bbox, info[primIndices[i]].bounds);
+        bin.count++;
     }
 
-    // ÿָSAHɱ
-    minCost = std::numeric_limits<float>::max();
-
-    for (int split = 1; split < BIN_COUNT; split++) {
-        Bounds3 leftBox;
-        Bounds3 rightBox;
-        int leftCount = 0, rightCount = 0;
-
-        // Χ
-        for (int i = 0; i < split; i++) {
-            if (bins[i].count > 0) { // ֻϲ bin
-                leftBox = uni(leftBox, bins[i].bbox);
-                leftCount += bins[i].count;
-            }
-        }
-
-        // Χ
-        for (int i = split; i < BIN_COUNT; i++) {
-            if (bins[i].count > 0) {
-                rightBox = uni(rightBox, bins[i].bbox);
-                rightCount += bins[i].count;
-            }
-        }
+    // ɨһ飬ÿָҲ
+    float rightArea[SAH_BIN_COUNT];
+    int rightCount[SAH_BIN_COUNT];
+    Bounds3 rightBox;
+    int count = 0;
+    for (int i = SAH_BIN_COUNT - 1; i > 0; i--) {
+        rightBox = uni(rightBox, bins[i].bbox);
+        count += bins[i].count;
+        rightArea[i] = count > 0 ? rightBox.SurfaceArea() : 0.0f;
+        rightCount[i] = count;
+    }
 
-        // SAHɱ = ɱ + ɱ
-        float cost = leftBox.SurfaceArea() * leftCount + rightBox.SurfaceArea() * rightCount;
+    // ٴɨָ split Ͱ [0, split)
+    float minCost = std::numeric_limits<float>::max();
+    int bestSplit = -1;
+    Bounds3 leftBox;
+    count = 0;
+    for (int split = 1; split < SAH_BIN_COUNT; split++) {
+        leftBox = uni(leftBox, bins[split - 1].bbox);
+        count += bins[split - 1].count;
+        if (count == 0 || rightCount[split] == 0) continue;
+        float cost = leftBox.SurfaceArea() * LeafCost(count, leafWidth) + rightArea[split] * LeafCost(rightCount[split], leafWidth);
         if (cost < minCost) {
             minCost = cost;
-            bestSplit =  split; // ӳСɱİΧ
+            bestSplit = split;
         }
     }
-	//ͰתΪ
-    int splitIndex = start;
-    for (int i = start; i < end; i++) {
-        float center = objects[i]->getCenter()[axis];
-        int binIdx = std::min(BIN_COUNT - 1,
-            static_cast<int>((center - objects[start]->bounding_box().pMin[axis]) / binWidth));
-        if (binIdx >= bestSplit) { // ˴bestSplitͰ
-            splitIndex = i;
-            break;
-        }
-    }
-    return splitIndex;
+    if (bestSplit < 0) return -1;
+
+    // ҶӴ = ִ =  + ʼȨӽڵ
+    int n = end - start;
+    float splitCost = SAH_TRAVERSAL_COST + minCost / bbox.SurfaceArea();
+    if (n <= maxLeafSize && splitCost >= LeafCost(n, leafWidth)) return -1;
+
+    auto mid = std::partition(primIndices.begin() + start, primIndices.begin() + end,
+        [&](int prim) { return binOf(prim) < bestSplit; });
+    return int(mid - primIndices.begin());
 }
 
-// ݹ鹹BVHSAHŻģ
-BVHNode* BuildBVH(
-    std::vector<std::shared_ptr<hittable>>& objects,
-    int start, int end,
-    int maxLeafSize 
-) {
-    if (start >= end) return nullptr;
+struct BVHBuildState {
+    const std::vector<BVHPrimitiveInfo>& info;
+    std::vector<int>& primIndices;
+    int maxLeafSize;
+    SplitMethod splitMethod;
+    thread_pool* pool;
+    int leafWidth;
+    std::atomic<int> totalNodes{ 0 };
+};
 
-    // 1. 㵱ǰڵΧ
-    Bounds3 bbox = ComputeBbox(objects, start, end);
+// ݹ鹹BVHֻ±򣬳˳򱣳ֲ䡣
+//  primIndices вཻ䣬Բй
+BVHNode* BuildBVH(BVHBuildState& state, int start, int end) {
+    if (start >= end) return nullptr;
+    const auto& info = state.info;
+    auto& primIndices = state.primIndices;
 
-    // 2. Ҷӽڵֹ
-    if (end - start <= maxLeafSize) {
-        auto node = new BVHNode;
-        node->bounds = bbox;
-        node->isLeaf = true;
-        node->objects.assign(objects.begin() + start, objects.begin() + end);
-        node->left = nullptr;
-        node->right = nullptr;
-        return node;
+    // 1. 㵱ǰڵΧкİΧ
+    Bounds3 bbox, centroidBounds;
+    for (int i = start; i < end; i++) {
+        const BVHPrimitiveInfo& prim = info[primIndices[i]];
+        bbox = uni(bbox, prim.bounds);
+        centroidBounds = uni(centroidBounds, Bounds3(prim.centroid, prim.centroid));
     }
 
-    // 3. ѡ
-    int axis = bbox.maxExtent();
-	float minCost = std::numeric_limits<float>::max();
-	float axisLen = bbox.pMax[axis] - bbox.pMin[axis];
-    // 4. ָ㣬ȷѭ
-	//int bestSplit = FindBestSplitWithSAH(objects, start, end, axis, minCost, axisLen);
-    int bestSplit = start + (end - start) / 2;
-    if (bestSplit == start || bestSplit == end) {
-        bestSplit = start + 1;
-    }
+    auto node = new BVHNode;
+    node->bounds = bbox;
+    state.totalNodes++;
 
-    auto comparator = [axis](const auto& a, const auto& b) {
-        return a->getCenter()[axis] < b->getCenter()[axis];
+    int n = end - start;
+    auto makeLeaf = [&]() {
+        node->isLeaf = true;
+        node->firstPrimOffset = start;
+        node->nPrimitives = n;
+        return node;
     };
-    std::sort(objects.begin() + start, objects.begin() + end, comparator);
+    if (n == 1) return makeLeaf();
 
-    // 5. ݹ鹹
-    BVHNode* left = BuildBVH(objects, start, bestSplit, maxLeafSize);
-    BVHNode* right = BuildBVH(objects, bestSplit, end, maxLeafSize);
+    // 2. ѡķֲᣬȫغʱ޷
+    int axis = centroidBounds.maxExtent();
+    bool degenerate = !(centroidBounds.pMax[axis] > centroidBounds.pMin[axis]);
+    if (degenerate && n <= UINT16_MAX) return makeLeaf();
 
-    auto node = new BVHNode;
-    node->bounds = bbox;
-    node->left = left;
-    node->right = right;
-    node->isLeaf = false;
+    // 3. ȷָ
+    int mid = -1;
+    if (state.splitMethod == SplitMethod::SAH && !degenerate) {
+        mid = FindBestSplitWithSAH(info, primIndices, start, end, bbox, centroidBounds, axis, state.maxLeafSize, state.leafWidth);
+        if (mid < 0) return makeLeaf();
+    }
+    else if (n <= state.maxLeafSize) {
+        return makeLeaf();
+    }
+    if (mid <= start || mid >= end) {
+        // λ֣ȷѭ
+        mid = start + n / 2;
+        std::nth_element(primIndices.begin() + start, primIndices.begin() + mid,
+            primIndices.begin() + end, [&info, axis](int a, int b) {
+                return info[a].centroid[axis] < info[b].centroid[axis];
+            });
+    }
+
+    // 4. ݹ鹹㹻̳߳أǰ̼߳
+    node->splitAxis = axis;
+    if (state.pool && n > PARALLEL_BUILD_THRESHOLD) {
+        std::atomic<int> pending(1);
+        state.pool->submit([&state, node, start, mid, &pending] {
+            node->left = BuildBVH(state, start, mid);
+            pending.fetch_sub(1, std::memory_order_release);
+        });
+        node->right = BuildBVH(state, mid, end);
+        state.pool->wait(pending);
+    }
+    else {
+        node->left = BuildBVH(state, start, mid);
+        node->right = BuildBVH(state, mid, end);
+    }
     return node;
 }
-bool BVHIntersect( 
-    BVHNode* node,
-    const ray& ray,
-    hit_record& rec,
-    float tMin = 0.001f,
-    float tMax = std::numeric_limits<float>::max()
-) {
-    // 1. ǷڵΧཻ
-    std::pair<float, bool> t = node->bounds.IntersectT(ray);
-    auto tEnter = t.first;
-    auto hit = t.second;
-    if (!hit || tEnter > tMax)
-        return false; // ټ֦
-
-    // 2. Ҷӽڵ㣺徫ȷ
+
+// Ȱѹд飬ظýڵ±
+int FlattenBVH(const BVHNode* node, std::vector<LinearBVHNode>& nodes) {
+    int offset = int(nodes.size());
+    nodes.emplace_back();
+    nodes[offset].bounds = node->bounds;
     if (node->isLeaf) {
-        bool hitAny = false;
-        for (const auto& obj : node->objects) {
-            if (obj->hit(ray, interval(tMin,tMax), rec)) {
-                tMax = rec.t; // 루ؼ֦
-                hitAny = true;
-            }
+        nodes[offset].primitivesOffset = node->firstPrimOffset;
+        nodes[offset].nPrimitives = uint16_t(node->nPrimitives);
+    }
+    else {
+        nodes[offset].axis = uint8_t(node->splitAxis);
+        FlattenBVH(node->left, nodes);
+        int second = FlattenBVH(node->right, nodes);
+        nodes[offset].secondChildOffset = second; // ע⣺ݹ nodes ݣܳ
+    }
+    return offset;
+}
+
+//  n İΧкģʱֿ齻̳߳
+template <class BoundsFn>
+void ComputePrimitiveInfo(int n, BoundsFn& bounds, thread_pool* pool, std::vector<BVHPrimitiveInfo>& info) {
+    info.resize(n);
+    auto computeInfo = [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            info[i].bounds = bounds(i);
+            info[i].centroid = info[i].bounds.Centroid();
         }
-        return hitAny;
+    };
+    if (pool && n > PARALLEL_BUILD_THRESHOLD) {
+        int chunks = pool->size() * 4;
+        pool->parallel_for(chunks, [&](int c) {
+            computeInfo(int(int64_t(n) * c / chunks), int(int64_t(n) * (c + 1) / chunks));
+        });
     }
+    else {
+        computeInfo(0, n);
+    }
+}
 
-    // 3. ڲڵ㣺ӽڵ
-    std::pair<float,bool> a= node->left->bounds.IntersectT(ray);
-    auto leftT = a.first;
-    auto leftHit = a.second;
+// 뾶1000ĵ壬ΧиסŽӸһڵ㶼ص
+// 󲿷ֹҪһ·µŲ⵽Ų primIndices ĩβؽ
+int PartitionOversized(const std::vector<BVHPrimitiveInfo>& info, std::vector<int>& primIndices) {
+    int n = int(primIndices.size());
+    Bounds3 centroidBounds;
+    for (int i : primIndices)
+        centroidBounds = uni(centroidBounds, Bounds3(info[i].centroid, info[i].centroid));
+    float limit = OVERSIZED_AREA_RATIO * centroidBounds.SurfaceArea();
+    int count = 0;
+    for (int i : primIndices)
+        count += info[i].bounds.SurfaceArea() > limit;
+    if (count == 0 || count > OVERSIZED_MAX_COUNT || 2 * count > n)
+        return n;
+    auto mid = std::stable_partition(primIndices.begin(), primIndices.end(),
+        [&info, limit](int i) { return !(info[i].bounds.SurfaceArea() > limit); });
+    return int(mid - primIndices.begin());
+}
 
-    std::pair<float, bool> b = node->right->bounds.IntersectT(ray);
-    auto rightT = b.first;
-    auto rightHit = b.second;
+//  primIndices[start, end) ѹƽҶƫ primIndices ľλã
+// ±ӷĿͷ𣻾ֲؽʱɵ÷ƴ
+std::vector<LinearBVHNode> BuildFlatBVH(
+    const std::vector<BVHPrimitiveInfo>& info,
+    std::vector<int>& primIndices,
+    int start, int end,
+    int maxLeafSize,
+    SplitMethod splitMethod,
+    thread_pool* pool,
+    int leafWidth
+) {
+    BVHBuildState state{ info, primIndices, maxLeafSize, splitMethod, pool, leafWidth };
+    BVHNode* root = BuildBVH(state, start, end);
+    std::vector<LinearBVHNode> nodes;
+    if (!root) return nodes;
+    nodes.reserve(state.totalNodes);
+    FlattenBVH(root, nodes);
+    delete root;
+    return nodes;
+}
 
-    // ȷЧ
-    if (!leftHit && !rightHit) return false;
+// ֻҪÿİΧ bounds(i)岻 hittableӳĳļ
+// ص bvh.objects ΪգҪ sphere_soup ֮Ҷӻص
+template <class BoundsFn>
+LinearBVH BuildLinearBVHFromBounds(
+    int n,
+    BoundsFn&& bounds,
+    int maxLeafSize,
+    SplitMethod splitMethod = SplitMethod::SAH,
+    thread_pool* pool = nullptr,
+    int leafWidth = 1
+) {
+    auto start = std::chrono::high_resolution_clock::now();
+    LinearBVH bvh;
+    if (n <= 0) return bvh;
 
-    // ȱ
-    BVHNode* first = node->left;
-    BVHNode* second = node->right;
-    if (rightHit && (!leftHit || rightT < leftT)) {
-        std::swap(first, second);
-        std::swap(leftT, rightT);
-    }
+    std::vector<BVHPrimitiveInfo> info;
+    ComputePrimitiveInfo(n, bounds, pool, info);
+    std::vector<int> primIndices(n);
+    for (int i = 0; i < n; i++)
+        primIndices[i] = i;
 
-    // 4. ݹtMax֦Զ
-    bool hitFirst = false;
-    if (first) {
-        hitFirst = BVHIntersect(first, ray, rec, tMin, tMax);
-        if (hitFirst) tMax = rec.t; // 
-    }
+    int treeCount = PartitionOversized(info, primIndices);
+    bvh.oversizedOffset = treeCount;
+    bvh.oversizedCount = n - treeCount;
+    bvh.nodes = bvh_array<LinearBVHNode>(
+        BuildFlatBVH(info, primIndices, 0, treeCount, maxLeafSize, splitMethod, pool, leafWidth));
+    bvh.primIndices = bvh_array<int>(std::move(primIndices));
 
-    // ׸Ҿ㹻ڶ
-    bool hitSecond = false;
-    if (second && tMax > rightT) { // ڶǷܸ
-        hitSecond = BVHIntersect(second, ray, rec, tMin, tMax);
-    }
+    auto end = std::chrono::high_resolution_clock::now();
+    bvh.buildMs = std::chrono::duration<float, std::milli>(end - start).count();
+    return bvh;
+}
 
-    return hitFirst || hitSecond;
+// pool Ϊʱ̹߳leafWidth ҶһܲвԵ
+LinearBVH BuildLinearBVH(
+    const std::vector<std::shared_ptr<hittable>>& objects,
+    int maxLeafSize,
+    SplitMethod splitMethod = SplitMethod::SAH,
+    thread_pool* pool = nullptr,
+    int leafWidth = 1
+) {
+    LinearBVH bvh = BuildLinearBVHFromBounds(int(objects.size()),
+        [&objects](int i) { return objects[i]->bounding_box(); }, maxLeafSize, splitMethod, pool, leafWidth);
+    bvh.objects = &objects;
+    return bvh;
 }
 
+// TraverseBVH ĬϵĽڵصʲôۼ
+struct no_node_visit {
+    void operator()(int) const {}
+};
 
+// ջʽݹ顣leaf(offset, count, tMax) Ҷ壬
+// ʱҪС tMax  truevisit(node) ÿβԽڵ֮ǰã
+// ߣmicrobench¼Щ
+template <class LeafFn, class VisitFn = no_node_visit>
+bool TraverseBVH(const LinearBVH& bvh, const ray& ray, float& tMax, LeafFn&& leaf, VisitFn&& visit = VisitFn()) {
+    if (bvh.empty()) return false;
 
+    const vec3& origin = ray.origin();
+    vec3 invDir(1.0f / ray.direction()[0], 1.0f / ray.direction()[1], 1.0f / ray.direction()[2]);
+    int dirIsNeg[3] = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
 
+    const LinearBVHNode* nodes = bvh.nodes.data();
+    int toVisit[64];
+    int toVisitOffset = 0;
+    int current = 0;
+    bool hitAny = false;
+    STAT_INC(traversals);
+    // Ȳ⣺к tMax ̣ԶĺֱӼ
+    if (bvh.oversizedCount > 0) {
+        STAT_ADD(primitiveTests, bvh.oversizedCount);
+        hitAny = leaf(bvh.oversizedOffset, bvh.oversizedCount, tMax);
+    }
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        STAT_INC(boxTests);
+        visit(current);
+        if (node.bounds.IntersectP(origin, invDir, dirIsNeg, tMax)) {
+            STAT_INC(nodesVisited);
+            if (node.nPrimitives > 0) {
+                STAT_INC(leavesVisited);
+                STAT_ADD(primitiveTests, node.nPrimitives);
+                if (leaf(node.primitivesOffset, int(node.nPrimitives), tMax)) {
+                    STAT_INC(leafHits);
+                    hitAny = true;
+                }
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+            else if (dirIsNeg[node.axis]) {
+                // ظᷴǰҺ
+                toVisit[toVisitOffset++] = current + 1;
+                current = node.secondChildOffset;
+            }
+            else {
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (toVisitOffset == 0) break;
+            current = toVisit[--toVisitOffset];
+        }
+    }
+    return hitAny;
+}
 
+bool BVHIntersect(
+    const LinearBVH& bvh,
+    const ray& ray,
+    hit_record& rec,
+    float tMin = 0.001f,
+    float tMax = std::numeric_limits<float>::max()
+) {
+    const auto& objects = *bvh.objects;
+    const int* primIndices = bvh.primIndices.data();
+    return TraverseBVH(bvh, ray, tMax, [&](int offset, int count, float& tMax) {
+        bool hitAny = false;
+        for (int i = offset; i < offset + count; i++) {
+            if (hit_object(*objects[primIndices[i]], ray, interval(tMin, tMax), rec)) {
+                tMax = rec.t; // ̹ߣĽڵԸ类
+                hitAny = true;
+            }
+        }
+        return hitAny;
+    });
+}
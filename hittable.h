@@ -2,6 +2,9 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include <cstdint>
+#include <type_traits>
+
 struct Bounds3; // ǰ fasterStructrue.h
 
 class material;
@@ -9,7 +12,7 @@ class hit_record {
 public:
     point3 p;
     vec3 normal;
-    std::shared_ptr<material> mat;
+    const material* mat = nullptr; // Owned by the scene; copying a hit record never touches a reference count
     float t;
     bool front_face;
     void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -17,15 +20,35 @@ public:
         normal = front_face ? outward_normal : -outward_normal;
     }
 };
+static_assert(std::is_trivially_copyable<hit_record>::value, "hit_record is copied on every closer hit");
+// ͼԪͱǣhit_object ֱӵͼԪ hit
+enum class hittable_type { sphere, other };
+
+// ԶͼԪ hittable Ϊ other麯
 class hittable {
 public:
+    hittable() = default;
     virtual ~hittable() = default;
+    hittable_type getType() const { return type; }
     virtual Bounds3 bounding_box() const = 0;
     virtual inline point3 getMaxCornerPoint() const = 0;
     virtual inline point3 getMinCornerPoint() const = 0;
     virtual const point3 getCenter() const = 0;
-    virtual const float getRadius() const = 0;
+    virtual float getRadius() const = 0;
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+    // ݹϣκͲʲ˶ϵͲΧϣ
+    // ԶͼԪдʱֻаΧв
+    virtual uint64_t content_key() const { return 0; }
+
+private:
+    // ֻͼԪԼͣhit_object ݴ static_cast
+    friend class sphere;
+    explicit hittable(hittable_type type) : type(type) {}
+
+    hittable_type type = hittable_type::other;
 };
 
+// ͷ󽻣 sphere.hҪͼԪͣ
+inline bool hit_object(const hittable& object, const ray& r, interval ray_t, hit_record& rec);
+
 #endif
\ No newline at end of file
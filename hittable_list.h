@@ -24,7 +24,7 @@ public:
     const point3 getCenter()const override {
         return point3(0, 0, 0);
     }
-    const float getRadius()const override {
+    float getRadius()const override {
         return 0;
     }
     void clear() { objects.clear(); }
@@ -39,7 +39,7 @@ public:
         auto closest_so_far = ray_t.max;
         //Ľ
         for (const auto& object : objects) {
-            if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            if (hit_object(*object, r, interval(ray_t.min, closest_so_far), temp_rec)) {
                 hit_anything = true;
                 closest_so_far = temp_rec.t;
                 rec = temp_rec;
@@ -0,0 +1,118 @@
+#pragma once
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+
+// Binary image output. The file is created at its final size and memory-mapped,
+// finished tiles are converted straight into it. P6 stores gamma 2 bytes like
+// write_color; PFM keeps the linear float framebuffer for compositing and for
+// merging partial renders.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "color.h"
+#include "mapped_file.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_OUTPUT_SSE2
+#endif
+
+enum class image_format {
+    ppm,        // Binary P6, 8 bit gamma 2
+    ppm_ascii,  // Text P3 through write_color
+    pfm         // Little-endian float RGB, linear
+};
+
+static_assert(sizeof(color) == 3 * sizeof(float), "framebuffer rows are read as packed floats");
+
+// Gamma 2, clamp to [0, 0.999] and scale to a byte for n floats. write_color
+// rounds the square root to float before clamping, and for a float x
+// int(256 * min(x, 0.999)) == min(int(256 * x), 255), so float lanes give
+// exactly the same bytes.
+inline void encode_gamma8(const float* in, uint8_t* out, size_t n) {
+    size_t i = 0;
+#if defined(__AVX__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 scale = _mm256_set1_ps(256.0f);
+    const __m256 top = _mm256_set1_ps(255.0f);
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_sqrt_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), zero));
+        __m256i v = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_mul_ps(x, scale), top));
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extractf128_si256(v, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(words, words));
+    }
+#elif defined(IMAGE_OUTPUT_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 scale = _mm_set1_ps(256.0f);
+    const __m128 top = _mm_set1_ps(255.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_sqrt_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero));
+        __m128i v = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(x, scale), top));
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        int packed = _mm_cvtsi128_si32(v);
+        std::memcpy(out + i, &packed, 4);
+    }
+#endif
+    static const interval intensity(0.000, 0.999);
+    for (; i < n; ++i) {
+        float gamma = float(linear_to_gamma(in[i]));
+        out[i] = uint8_t(int(256 * intensity.clamp(gamma)));
+    }
+}
+
+class image_writer {
+public:
+    // Creates the mapped file for a binary format and writes its header.
+    bool open(const std::string& path, image_format fmt, int w, int h) {
+        format = fmt;
+        width = w;
+        height = h;
+        std::string header = format == image_format::pfm
+            ? "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n"
+            : "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        size_t pixel_bytes = format == image_format::pfm ? 3 * sizeof(float) : 3;
+        if (!file.create(path, header.size() + pixel_bytes * size_t(width) * height))
+            return false;
+        std::memcpy(file.data(), header.data(), header.size());
+        data_offset = header.size();
+        return true;
+    }
+
+    bool is_open() const { return file.is_open(); }
+
+    // Converts the rectangle [x0, x1) x [y0, y1) of the framebuffer into the
+    // file. Tiles touch disjoint bytes, so workers may call this concurrently.
+    void write_tile(const std::vector<color>& framebuffer, int x0, int y0, int x1, int y1) {
+        if (!file.is_open())
+            return;
+        char* pixels = file.data() + data_offset;
+        for (int y = y0; y < y1; ++y) {
+            const float* row = framebuffer[size_t(y) * width + x0].e;
+            size_t count = size_t(x1 - x0) * 3;
+            if (format == image_format::pfm) {
+                // PFM stores the bottom row first
+                size_t offset = (size_t(height - 1 - y) * width + x0) * 3 * sizeof(float);
+                std::memcpy(pixels + offset, row, count * sizeof(float));
+            }
+            else {
+                size_t offset = (size_t(y) * width + x0) * 3;
+                encode_gamma8(row, reinterpret_cast<uint8_t*>(pixels) + offset, count);
+            }
+        }
+    }
+
+    void close() { file.close(); }
+
+private:
+    mapped_file file;
+    image_format format = image_format::ppm;
+    int width = 0;
+    int height = 0;
+    size_t data_offset = 0;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+// Two-level acceleration: every unique piece of geometry is built into a
+// bottom-level BVH once (geometry_bvh here, or a triangle_mesh, which carries
+// its own), and the scene places it any number of times through instances.
+// The world BVH over the instances is the top level. A ray is moved into the
+// instance's object space, traced through the shared bottom-level tree and the
+// hit moved back, so memory grows with the unique geometry plus one small
+// record per instance. Moving an instance only changes its transform and box:
+// rebuilding the world BVH afterwards touches the top level alone.
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "rtweekend.h"
+#include "accelerator.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "thread_pool.h"
+#include "transform.h"
+
+// A group of objects with an accelerator of its own, the bottom level for
+// instances of the group; it picks its structure for the group alone, so a
+// small part may be scanned while a large one gets a wide tree. The
+// accelerator points into `objects`, so the group is built in place (through
+// the scene arena) and never copied.
+class geometry_bvh final : public hittable {
+public:
+    explicit geometry_bvh(std::vector<shared_ptr<hittable>> objects, thread_pool* pool = nullptr,
+        const accel_costs& costs = host_accel_costs())
+        : objects(std::move(objects)) {
+        accel.build(this->objects, pool, costs);
+        key = mix64(uint64_t(this->objects.size()));
+        for (const auto& object : this->objects) {
+            box = uni(box, object->bounding_box());
+            key = mix64(hash_bounds(key, object->bounding_box()) ^ object->content_key());
+        }
+    }
+    geometry_bvh(const geometry_bvh&) = delete;
+    geometry_bvh& operator=(const geometry_bvh&) = delete;
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        float tMax = float(std::min(ray_t.max, double(std::numeric_limits<float>::max())));
+        return accel.hit(r, rec, float(ray_t.min), tMax);
+    }
+
+    Bounds3 bounding_box() const override { return box; }
+    inline point3 getMaxCornerPoint() const override { return box.pMax; }
+    inline point3 getMinCornerPoint() const override { return box.pMin; }
+    const point3 getCenter() const override { return box.Centroid(); }
+    float getRadius() const override { return 0.5f * (box.pMax - box.pMin).length(); }
+    uint64_t content_key() const override { return key; }
+
+    int objectCount() const { return int(objects.size()); }
+    const accelerator& getAccelerator() const { return accel; }
+
+private:
+    std::vector<shared_ptr<hittable>> objects;
+    accelerator accel;
+    Bounds3 box;
+    uint64_t key = 0;  // Of every object, hashed once: the group never changes
+};
+
+// One placement of shared geometry. The object-space ray keeps the world ray's
+// parameterisation (its direction is transformed, not normalised), so t and the
+// ray interval mean the same on both sides.
+class instance final : public hittable {
+public:
+    // mat, when set, replaces the materials of the geometry for this instance.
+    instance(shared_ptr<hittable> geometry, const transform& to_world, shared_ptr<material> mat = nullptr)
+        : geometry(std::move(geometry)), mat(std::move(mat)) {
+        setTransform(to_world);
+    }
+
+    // After moving instances, rebuild the world (top-level) BVH; the geometry
+    // is untouched.
+    void setTransform(const transform& to_world) {
+        this->to_world = to_world;
+        to_object = to_world.inverse();
+        box = to_world.bounds(geometry->bounding_box());
+    }
+    const transform& getTransform() const { return to_world; }
+    const shared_ptr<hittable>& getGeometry() const { return geometry; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        ray local(to_object.point(r.origin()), to_object.vector(r.direction()));
+        if (!hit_object(*geometry, local, ray_t, rec))
+            return false;
+
+        // Normals go through the inverse transpose, which keeps their side of
+        // the ray: front_face and the flipped normal stay valid.
+        rec.p = r.at(rec.t);
+        rec.normal = unit_vector(to_object.normal(rec.normal));
+        if (mat) rec.mat = mat.get();
+        return true;
+    }
+
+    Bounds3 bounding_box() const override { return box; }
+    inline point3 getMaxCornerPoint() const override { return box.pMax; }
+    inline point3 getMinCornerPoint() const override { return box.pMin; }
+    const point3 getCenter() const override { return box.Centroid(); }
+    float getRadius() const override { return 0.5f * (box.pMax - box.pMin).length(); }
+    // The placement, the material override and the shared geometry
+    uint64_t content_key() const override {
+        uint64_t key = mix64(hash_bounds(0, geometry->bounding_box()) ^ geometry->content_key());
+        for (const auto& row : to_world.m)
+            for (float v : row)
+                key = mix_float(key, v);
+        return mix64(key ^ (mat ? material_key(*mat) : 0));
+    }
+
+private:
+    shared_ptr<hittable> geometry;
+    shared_ptr<material> mat;
+    transform to_world;
+    transform to_object;
+    Bounds3 box;
+};
+
+#endif
@@ -0,0 +1,165 @@
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+// Memory-mapped file, either created with a fixed size for writing or opened
+// read-only as a whole. Pages are written back by the OS, so disjoint parts of
+// a writable mapping can be filled from several threads without any locking.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class mapped_file {
+public:
+    mapped_file() = default;
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // Creates (or truncates) path with exactly `bytes` bytes and maps it read-write.
+    bool create(const std::string& path, size_t bytes) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        return map(bytes, true);
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        if (::ftruncate(fd, off_t(bytes)) != 0) {
+            close();
+            return false;
+        }
+        return map(bytes, true);
+#endif
+    }
+
+    // Maps the whole existing file read-only.
+    bool open_read(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER bytes;
+        if (!GetFileSizeEx(file, &bytes)) {
+            close();
+            return false;
+        }
+        return map(size_t(bytes.QuadPart), false);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            close();
+            return false;
+        }
+        return map(size_t(st.st_size), false);
+#endif
+    }
+
+    bool is_open() const { return opened; }
+    char* data() { return ptr; }
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+    // Pushes the dirty pages to the file now instead of whenever the OS likes.
+    bool flush() {
+        if (!ptr || !writable)
+            return true;
+#ifdef _WIN32
+        return FlushViewOfFile(ptr, 0) != 0;
+#else
+        return ::msync(ptr, length, MS_SYNC) == 0;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (ptr)
+            UnmapViewOfFile(ptr);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (ptr)
+            ::munmap(ptr, length);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        ptr = nullptr;
+        length = 0;
+        opened = false;
+        writable = false;
+    }
+
+private:
+    char* ptr = nullptr;
+    size_t length = 0;
+    bool opened = false;
+    bool writable = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    // An empty file is valid but cannot be mapped, it keeps a null data().
+    bool map(size_t bytes, bool write) {
+        length = bytes;
+        writable = write;
+        if (bytes == 0) {
+            opened = true;
+            return true;
+        }
+#ifdef _WIN32
+        mapping = CreateFileMappingA(file, nullptr, write ? PAGE_READWRITE : PAGE_READONLY,
+            DWORD(uint64_t(bytes) >> 32), DWORD(bytes & 0xffffffffu), nullptr);
+        if (mapping)
+            ptr = static_cast<char*>(MapViewOfFile(mapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, bytes));
+        if (!ptr) {
+            close();
+            return false;
+        }
+#else
+        void* p = ::mmap(nullptr, bytes, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            close();
+            return false;
+        }
+        ptr = static_cast<char*>(p);
+#endif
+        opened = true;
+        return true;
+    }
+};
+
+#endif
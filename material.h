@@ -1,23 +1,39 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <cstring>
 #include "hittable.h"
 
+// ͱǣǰȾзɫ
+enum class material_type { lambertian, metal, dielectric, other };
+const int material_type_count = 4;
 
+// Զʴ material д scatterkind Ϊ other麯
+// ò final ࣬scatter_material  kind ֱӵã
 class material {
 public:
+    material() : kind(material_type::other) {}
     virtual ~material() = default;
 
+    const material_type kind;
+
     virtual bool scatter(
         const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
     ) const {
         return false;
     }
+
+private:
+    // ֻòԼͣscatter_material ݴ static_cast
+    friend class lambertian;
+    friend class metal;
+    friend class dielectric;
+    explicit material(material_type kind) : kind(kind) {}
 };
 //뷴 ÿ䷽ʶͬ
-class lambertian : public material {
+class lambertian final : public material {
 public:
-    lambertian(const color& albedo) : albedo( ) {}
+    lambertian(const color& albedo) : material(material_type::lambertian), albedo(albedo) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
         const override {
@@ -32,15 +48,16 @@ public:
         attenuation = albedo;
         return true;
     }
+    const color& getAlbedo() const { return albedo; }
 
 private:
     //
     color albedo;
 };
 // շ䶨
-class metal : public material {
+class metal final : public material {
 public:
-    metal(const color& albedo,float fuzz) : albedo(albedo),fuzz(fuzz) {}
+    metal(const color& albedo,float fuzz) : material(material_type::metal), albedo(albedo),fuzz(fuzz) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
         const override {
@@ -51,6 +68,8 @@ public:
         //
         return dot(rec.normal,reflected)>0;
     }
+    const color& getAlbedo() const { return albedo; }
+    float getFuzz() const { return fuzz; }
 
 private:
     color albedo;
@@ -58,10 +77,10 @@ private:
     float fuzz;
 };
 //
-class dielectric : public material {
+class dielectric final : public material {
 public:
     //refraction_index n2/n1
-    dielectric(double refraction_index) : refraction_index(refraction_index) {}
+    dielectric(double refraction_index) : material(material_type::dielectric), refraction_index(refraction_index) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
         const override {
@@ -87,14 +106,61 @@ public:
         return true;
     }
 
-private:
-
-    double refraction_index;
     static double reflectance(double cosine, double refraction_index) {
         // Use Schlick's approximation for reflectance.
         auto r0 = (1 - refraction_index) / (1 + refraction_index);
         r0 = r0 * r0;
         return r0 + (1 - r0) * std::pow((1 - cosine), 5);
     }
+
+    double refractionIndex() const { return refraction_index; }
+
+private:
+
+    double refraction_index;
 };
+
+//  kind ɢ䣺òֱӵãfinal ࣬ã麯
+inline bool scatter_material(const material& mat, const ray& r_in, const hit_record& rec, color& attenuation,
+    ray& scattered) {
+    switch (mat.kind) {
+    case material_type::lambertian:
+        return static_cast<const lambertian&>(mat).scatter(r_in, rec, attenuation, scattered);
+    case material_type::metal:
+        return static_cast<const metal&>(mat).scatter(r_in, rec, attenuation, scattered);
+    case material_type::dielectric:
+        return static_cast<const dielectric&>(mat).scatter(r_in, rec, attenuation, scattered);
+    default:
+        return mat.scatter(r_in, rec, attenuation, scattered);
+    }
+}
+
+// ʲĹϣ˶ϵͲòʹϣͺͲԶֻ
+inline uint64_t material_key(const material& mat) {
+    uint64_t key = mix64(uint64_t(mat.kind));
+    auto add = [&key](float v) {
+        uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        key = mix64(key ^ bits);
+    };
+    switch (mat.kind) {
+    case material_type::lambertian: {
+        const color& albedo = static_cast<const lambertian&>(mat).getAlbedo();
+        for (int i = 0; i < 3; ++i) add(albedo[i]);
+        break;
+    }
+    case material_type::metal: {
+        const metal& m = static_cast<const metal&>(mat);
+        for (int i = 0; i < 3; ++i) add(m.getAlbedo()[i]);
+        add(m.getFuzz());
+        break;
+    }
+    case material_type::dielectric:
+        add(float(static_cast<const dielectric&>(mat).refractionIndex()));
+        break;
+    default:
+        break;
+    }
+    return key;
+}
 #endif
@@ -0,0 +1,250 @@
+// microbench.cpp : micro-benchmarks of the innermost kernels.
+//
+// Usage: microbench [--scene final|100k] [--json microbench.json]
+//
+// The inputs are recorded once by tracing real paths through a seeded scene:
+// every camera and bounce ray, the (ray, node) box tests and (ray, sphere) tests
+// the BVH traversal performs, and the closest hits with their materials. Each
+// kernel is then timed alone on that distribution, so a SIMD or layout change
+// can be judged in seconds instead of after a full render.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "scenes.h"
+
+struct recorded_paths {
+    std::vector<ray> rays;                       // Every traced ray, camera rays first
+    std::vector<std::pair<int, int>> box_tests;  // (ray, node) slab tests done by the traversal
+    std::vector<std::pair<int, int>> sphere_tests;  // (ray, object) tests done in the leaves
+    std::vector<ray> hit_rays;                   // Incoming ray of every closest hit
+    std::vector<hit_record> hits;
+};
+
+const size_t MAX_RECORDED = 1 << 21;
+
+// BVHIntersect through the real TraverseBVH, remembering every box and
+// sphere test it makes.
+static bool record_intersection(const LinearBVH& bvh, int rayIndex, recorded_paths& rec, hit_record& hit) {
+    const ray& r = rec.rays[rayIndex];
+    const auto& objects = *bvh.objects;
+    float tMax = std::numeric_limits<float>::max();
+    return TraverseBVH(bvh, r, tMax, [&](int offset, int count, float& tMax) {
+        bool hitAny = false;
+        for (int i = offset; i < offset + count; ++i) {
+            int object = bvh.primIndices[i];
+            if (rec.sphere_tests.size() < MAX_RECORDED)
+                rec.sphere_tests.emplace_back(rayIndex, object);
+            if (hit_object(*objects[object], r, interval(0.001f, tMax), hit)) {
+                tMax = hit.t;
+                hitAny = true;
+            }
+        }
+        return hitAny;
+    }, [&](int node) {
+        if (rec.box_tests.size() < MAX_RECORDED)
+            rec.box_tests.emplace_back(rayIndex, node);
+    });
+}
+
+// Traces width x height x spp paths from the scene's camera: the camera rays
+// are the ones camera::render traces. Records every kernel input on the way.
+static recorded_paths record_paths(const scene_desc& scene, const LinearBVH& bvh, int width, int spp) {
+    recorded_paths rec;
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = width;
+    cam.vfov = scene.vfov;
+    cam.lookfrom = scene.lookfrom;
+    cam.lookat = scene.lookat;
+    int height = cam.prepare();
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int s = 0; s < spp; ++s) {
+                ray r = cam.sample_ray(x, y, s);
+                for (int depth = 1; depth <= 8; ++depth) {
+                    rec.rays.push_back(r);
+                    hit_record hit;
+                    if (!record_intersection(bvh, int(rec.rays.size()) - 1, rec, hit))
+                        break;
+                    rec.hit_rays.push_back(r);
+                    rec.hits.push_back(hit);
+                    ray scattered;
+                    color attenuation;
+                    if (!scatter_material(*hit.mat, r, hit, attenuation, scattered))
+                        break;
+                    r = ray(hit.p + hit.normal * 0.001f, scattered.direction());
+                }
+            }
+        }
+    }
+    return rec;
+}
+
+struct micro_result {
+    std::string name;
+    size_t items;
+    double ns_per_op;
+};
+
+static volatile float benchmark_sink;
+
+// Sweeps body(0) .. body(items - 1) until at least 0.25 s have passed and
+// reports the time per call. body returns a float that is folded into a sink
+// so the compiler cannot drop the work.
+template <class F>
+micro_result measure(const std::string& name, size_t items, F&& body) {
+    micro_result result{ name, items, 0 };
+    if (items == 0)
+        return result;
+    float sink = 0;
+    for (size_t i = 0; i < std::min<size_t>(items, 1024); ++i)
+        sink += body(i);
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < 0.25) {
+        for (size_t i = 0; i < items; ++i)
+            sink += body(i);
+        calls += items;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    benchmark_sink = sink;
+    result.ns_per_op = elapsed * 1e9 / double(calls);
+    std::printf("%-28s %10zu %10.2f ns %10.2f M/s\n", name.c_str(), items, result.ns_per_op, 1e3 / result.ns_per_op);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    std::string sceneName = "final";
+    std::string json = "microbench.json";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--scene")) sceneName = argv[i + 1];
+        else if (!std::strcmp(argv[i], "--json")) json = argv[i + 1];
+        else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return 1;
+        }
+    }
+    scene_desc scene = sceneName == "100k" ? sphere_field(sceneName, 100000, 100) : final_scene(0);
+    const auto& objects = scene.world.objects;
+    LinearBVH bvh = BuildLinearBVH(objects, 8, SplitMethod::SAH, nullptr, soup_lanes::width);
+    sphere_soup soup;
+    bool allSpheres = BuildSphereSoup(objects, &bvh.primIndices, soup);
+    WideBVH4 bvh4 = CollapseBVH<4>(bvh);
+    WideBVH8 bvh8 = CollapseBVH<8>(bvh);
+    QuantizedBVH8 qbvh8 = CompressBVH<8>(bvh);
+    sphere_soup qsoup;  // The quantized tree orders its leaves differently
+    BuildSphereSoup(objects, &qbvh8.primIndices, qsoup);
+
+    recorded_paths rec = record_paths(scene, bvh, 160, 4);
+    std::printf("Recorded %zu rays, %zu box tests, %zu sphere tests, %zu hits\n\n", rec.rays.size(),
+        rec.box_tests.size(), rec.sphere_tests.size(), rec.hits.size());
+
+    std::vector<vec3> invDirs;
+    for (const ray& r : rec.rays)
+        invDirs.emplace_back(1.0f / r.direction()[0], 1.0f / r.direction()[1], 1.0f / r.direction()[2]);
+
+    std::vector<int> byKind[material_type_count];
+    for (size_t i = 0; i < rec.hits.size(); ++i)
+        byKind[int(rec.hits[i].mat->kind)].push_back(int(i));
+
+    // Dielectric hits as refract / reflectance see them
+    std::vector<vec3> glassDirs;
+    std::vector<float> glassCos, glassRatio;
+    for (int i : byKind[int(material_type::dielectric)]) {
+        const hit_record& h = rec.hits[i];
+        double index = static_cast<const dielectric*>(h.mat)->refractionIndex();
+        vec3 dir = unit_vector(rec.hit_rays[i].direction());
+        glassDirs.push_back(dir);
+        glassCos.push_back(std::fmin(dot(-dir, h.normal), 1.0f));
+        glassRatio.push_back(float(h.front_face ? 1.0 / index : index));
+    }
+
+    std::vector<micro_result> results;
+    results.push_back(measure("sphere::hit", rec.sphere_tests.size(), [&](size_t i) {
+        hit_record h;
+        const auto& test = rec.sphere_tests[i];
+        return hit_object(*objects[test.second], rec.rays[test.first], interval(0.001, infinity), h) ? h.t : 0.0f;
+    }));
+    results.push_back(measure("Bounds3::IntersectT", rec.box_tests.size(), [&](size_t i) {
+        const auto& test = rec.box_tests[i];
+        auto t = bvh.nodes[test.second].bounds.IntersectT(rec.rays[test.first]);
+        return t.second ? t.first : 0.0f;
+    }));
+    results.push_back(measure("Bounds3::IntersectP", rec.box_tests.size(), [&](size_t i) {
+        const auto& test = rec.box_tests[i];
+        const vec3& invDir = invDirs[test.first];
+        int dirIsNeg[3] = { invDir[0] < 0, invDir[1] < 0, invDir[2] < 0 };
+        return bvh.nodes[test.second].bounds.IntersectP(rec.rays[test.first].origin(), invDir, dirIsNeg,
+            std::numeric_limits<float>::max()) ? 1.0f : 0.0f;
+    }));
+    results.push_back(measure("BVHIntersect", rec.rays.size(), [&](size_t i) {
+        hit_record h;
+        return BVHIntersect(bvh, rec.rays[i], h) ? h.t : 0.0f;
+    }));
+    results.push_back(measure("WideBVHIntersect<4>", rec.rays.size(), [&](size_t i) {
+        hit_record h;
+        return WideBVHIntersect(bvh4, rec.rays[i], h) ? h.t : 0.0f;
+    }));
+    results.push_back(measure("WideBVHIntersect<8>", rec.rays.size(), [&](size_t i) {
+        hit_record h;
+        return WideBVHIntersect(bvh8, rec.rays[i], h) ? h.t : 0.0f;
+    }));
+    results.push_back(measure("QuantizedBVHIntersect<8>", rec.rays.size(), [&](size_t i) {
+        hit_record h;
+        return QuantizedBVHIntersect(qbvh8, rec.rays[i], h) ? h.t : 0.0f;
+    }));
+    if (allSpheres) {
+        results.push_back(measure("BVHIntersect soup", rec.rays.size(), [&](size_t i) {
+            hit_record h;
+            return BVHIntersect(bvh, soup, rec.rays[i], h) ? h.t : 0.0f;
+        }));
+        results.push_back(measure("WideBVHIntersect<4> soup", rec.rays.size(), [&](size_t i) {
+            hit_record h;
+            return WideBVHIntersect(bvh4, soup, rec.rays[i], h) ? h.t : 0.0f;
+        }));
+        results.push_back(measure("QuantizedBVHIntersect<8> soup", rec.rays.size(), [&](size_t i) {
+            hit_record h;
+            return QuantizedBVHIntersect(qbvh8, qsoup, rec.rays[i], h) ? h.t : 0.0f;
+        }));
+    }
+    const char* kindNames[material_type_count] = { "lambertian", "metal", "dielectric", "other" };
+    for (int k = 0; k < material_type_count; ++k) {
+        const std::vector<int>& hitsOfKind = byKind[k];
+        if (hitsOfKind.empty())
+            continue;
+        results.push_back(measure(std::string("scatter ") + kindNames[k], hitsOfKind.size(), [&](size_t i) {
+            int h = hitsOfKind[i];
+            ray scattered;
+            color attenuation;
+            return scatter_material(*rec.hits[h].mat, rec.hit_rays[h], rec.hits[h], attenuation, scattered)
+                ? scattered.direction().x() : 0.0f;
+        }));
+    }
+    results.push_back(measure("random_unit_vector", 1 << 20, [&](size_t) {
+        return random_unit_vector().x();
+    }));
+    results.push_back(measure("refract", glassDirs.size(), [&](size_t i) {
+        return refract(glassDirs[i], rec.hits[byKind[int(material_type::dielectric)][i]].normal, glassRatio[i]).x();
+    }));
+    results.push_back(measure("dielectric::reflectance", glassCos.size(), [&](size_t i) {
+        return float(dielectric::reflectance(glassCos[i], glassRatio[i]));
+    }));
+
+    std::ofstream out(json);
+    out << "{\n  \"scene\": \"" << scene.name << "\",\n  \"kernels\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        out << "    {\"name\": \"" << results[i].name << "\", \"items\": " << results[i].items
+            << ", \"ns_per_op\": " << results[i].ns_per_op << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    std::cout << "\nWrote " << json << "\n";
+}
@@ -0,0 +1,137 @@
+#pragma once
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+// Streaming Wavefront OBJ reader for triangle meshes. The file is mapped and
+// parsed in one pass straight from the mapping with std::from_chars: no line
+// buffers, no strings, nothing allocated except the growing vertex and index
+// arrays. Only `v` and `f` lines are read; polygons are split into fans and
+// every other statement (normals, texture coordinates, groups, materials) is
+// skipped.
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "rtweekend.h"
+#include "mapped_file.h"
+
+struct obj_load_stats {
+    size_t bytes = 0;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    double ms = 0;
+
+    double mb_per_second() const { return ms > 0 ? bytes / (1024.0 * 1024.0) / (ms / 1000.0) : 0; }
+};
+
+class obj_parser {
+public:
+    obj_parser(const char* begin, const char* end) : p(begin), end(end) {}
+
+    // Errors are reported with their line number.
+    bool parse(const std::string& path, std::vector<point3>& vertices, std::vector<uint32_t>& indices) {
+        for (; p < end; next_line()) {
+            skip_spaces();
+            if (p + 1 < end && p[0] == 'v' && is_space(p[1])) {
+                ++p;
+                float v[3];
+                for (float& x : v) {
+                    skip_spaces();
+                    auto result = std::from_chars(p, end, x);
+                    if (result.ec != std::errc())
+                        return error(path, "bad vertex");
+                    p = result.ptr;
+                }
+                vertices.emplace_back(v[0], v[1], v[2]);
+            }
+            else if (p + 1 < end && p[0] == 'f' && is_space(p[1])) {
+                ++p;
+                uint32_t first = 0, previous = 0;
+                int corners = 0;
+                while (true) {
+                    skip_spaces();
+                    if (p >= end || *p == '\n' || *p == '\r' || *p == '#')
+                        break;
+                    long long index;
+                    auto result = std::from_chars(p, end, index);
+                    if (result.ec != std::errc())
+                        return error(path, "bad face");
+                    p = result.ptr;
+                    while (p < end && !is_space(*p) && *p != '\n' && *p != '\r')
+                        ++p;   // Texture coordinate and normal indices
+                    // 1-based, negative counts back from the last vertex
+                    long long resolved = index > 0 ? index - 1 : (long long)vertices.size() + index;
+                    if (index == 0 || resolved < 0 || resolved >= (long long)vertices.size())
+                        return error(path, "face index out of range");
+                    uint32_t current = uint32_t(resolved);
+                    if (corners == 0) first = current;
+                    else if (corners >= 2) {
+                        indices.push_back(first);
+                        indices.push_back(previous);
+                        indices.push_back(current);
+                    }
+                    previous = current;
+                    ++corners;
+                }
+                if (corners < 3)
+                    return error(path, "face with less than three corners");
+            }
+        }
+        return true;
+    }
+
+private:
+    const char* p;
+    const char* end;
+    int line = 1;
+
+    static bool is_space(char c) { return c == ' ' || c == '\t'; }
+    void skip_spaces() {
+        while (p < end && is_space(*p)) ++p;
+    }
+    void next_line() {
+        while (p < end && *p != '\n') ++p;
+        if (p < end) {
+            ++p;
+            ++line;
+        }
+    }
+    bool error(const std::string& path, const char* what) const {
+        std::cerr << path << ":" << line << ": " << what << "\n";
+        return false;
+    }
+};
+
+// Reads the mesh of an OBJ file into vertices / indices (three per triangle).
+// A file without faces is an error: there is no mesh to show.
+inline bool load_obj(const std::string& path, std::vector<point3>& vertices, std::vector<uint32_t>& indices,
+    obj_load_stats* stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    vertices.clear();
+    indices.clear();
+    mapped_file file;
+    if (!file.open_read(path)) {
+        std::cerr << path << ": cannot open\n";
+        return false;
+    }
+    obj_parser parser(file.data(), file.data() + file.size());
+    if (!parser.parse(path, vertices, indices))
+        return false;
+    if (indices.empty()) {
+        std::cerr << path << ": no faces\n";
+        return false;
+    }
+
+    if (stats) {
+        stats->bytes = file.size();
+        stats->vertices = vertices.size();
+        stats->triangles = indices.size() / 3;
+        stats->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return true;
+}
+
+#endif
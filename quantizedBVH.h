@@ -0,0 +1,343 @@
+#pragma once
+#ifndef QUANTIZEDBVH_H
+#define QUANTIZEDBVH_H
+
+// N-wide BVH with quantized child boxes, for scenes whose trees would not fit
+// in memory or cache otherwise. A node keeps the corner of its box in floats
+// and a power of two step per axis; each child box is stored as 8 bit
+// multiples of that step, rounded outwards so the decoded box always contains
+// the exact one. A few extra boxes are entered, no hit is ever missed.
+//
+// Children are not addressed one by one. The interior children of a node are
+// stored next to each other in the node array and its leaf children next to
+// each other in primIndices, so a node needs only the two first indices. For
+// that the tree has its own leaf order (primIndices), and leaf data kept in
+// leaf order, like a sphere_soup, has to follow it.
+//
+// With N = 8 a node is 80 bytes where WideBVHNode<8> takes 256.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "wideBVH.h"
+
+const uint8_t QBVH_INTERIOR = 0xFF;  // meta of an interior child; leaves store their primitive count
+const int QBVH_MAX_LEAF = 0xFE;      // Larger leaves are split over an extra node
+
+template <int N>
+struct QuantizedBVHNode {
+    float origin[3];        // Lower corner of the node box
+    int8_t exponent[3];     // Child coordinates are in steps of 2^exponent per axis
+    uint8_t pad;
+    int32_t childBase;      // Node index of the first interior child, the others follow it
+    int32_t primBase;       // primIndices offset of the first leaf child, the others follow it
+    uint8_t meta[N];        // Per child: 0 empty, QBVH_INTERIOR, or the leaf primitive count
+    uint8_t qmin[3][N];     // Child boxes: origin + q * step
+    uint8_t qmax[3][N];
+};
+static_assert(sizeof(QuantizedBVHNode<8>) == 80, "QuantizedBVHNode<8> should stay 80 bytes");
+
+template <int N>
+struct QuantizedBVH {
+    std::vector<QuantizedBVHNode<N>> nodes;
+    bvh_array<int> primIndices;  // Leaf order of this tree, not the one of the binary tree it came from
+    const std::vector<std::shared_ptr<hittable>>* objects = nullptr;
+    int oversizedOffset = 0;     // As in LinearBVH
+    int oversizedCount = 0;
+
+    bool empty() const { return nodes.empty(); }
+    size_t MemoryBytes() const { return nodes.size() * sizeof(QuantizedBVHNode<N>); }
+};
+
+typedef QuantizedBVH<4> QuantizedBVH4;
+typedef QuantizedBVH<8> QuantizedBVH8;
+
+inline float QuantizedStep(int exponent) {
+    uint32_t bits = uint32_t(exponent + 127) << 23;
+    float step;
+    std::memcpy(&step, &bits, sizeof(step));
+    return step;
+}
+
+// A child while compressing: a binary node, or a range of primIndices too
+// large for one leaf slot, which keeps the box of the leaf it came from.
+struct QuantizedBuildItem {
+    Bounds3 bounds;
+    int node;   // Binary node index, -1 for a range
+    int first;  // Range in the binary tree's primIndices
+    int count;  // 0 for an interior binary node
+};
+
+// Quantizes one axis of the child boxes against `origin`. The step is the
+// smallest power of two that spans the node in 255 steps, or larger if
+// rounding pushes a box past 255 steps. Returns the exponent.
+template <int N>
+int QuantizeAxis(const QuantizedBuildItem* kids, int k, float origin, float extent, int axis,
+    uint8_t qmin[N], uint8_t qmax[N]) {
+    int exponent;
+    std::frexp(extent / 255.0f, &exponent);
+    exponent = std::max(exponent, -126);
+    for (;; ++exponent) {
+        float step = QuantizedStep(exponent);
+        auto decode = [origin, step](int q) { return origin + float(q) * step; };
+        bool fits = true;
+        for (int i = 0; i < k && fits; ++i) {
+            float lo = kids[i].bounds.pMin[axis], hi = kids[i].bounds.pMax[axis];
+            int q0 = std::min(std::max(int(std::floor((lo - origin) / step)), 0), 255);
+            while (q0 > 0 && decode(q0) > lo) --q0;
+            int q1 = std::min(std::max(int(std::ceil((hi - origin) / step)), 0), 255);
+            while (q1 < 255 && decode(q1) < hi) ++q1;
+            fits = decode(q0) <= lo && decode(q1) >= hi;
+            qmin[i] = uint8_t(q0);
+            qmax[i] = uint8_t(q1);
+        }
+        if (fits || exponent >= 127) return exponent;
+    }
+}
+
+template <int N>
+int ExpandQuantizedItem(const LinearBVH& binary, const QuantizedBuildItem& item, QuantizedBuildItem kids[N]) {
+    if (item.node >= 0 && item.count == 0) {
+        int binKids[N];
+        int k = CollapseChildren<N>(binary, item.node, binKids);
+        for (int i = 0; i < k; ++i) {
+            const LinearBVHNode& c = binary.nodes[binKids[i]];
+            kids[i] = { c.bounds, binKids[i], c.nPrimitives > 0 ? c.primitivesOffset : 0, c.nPrimitives };
+        }
+        return k;
+    }
+    if (item.count <= QBVH_MAX_LEAF) {
+        kids[0] = item;  // A root that is a leaf
+        return 1;
+    }
+    int chunk = (item.count + N - 1) / N;
+    int k = 0;
+    for (int first = item.first; first < item.first + item.count; first += chunk)
+        kids[k++] = { item.bounds, -1, first, std::min(chunk, item.first + item.count - first) };
+    return k;
+}
+
+// Fills node `index` from item: interior children take consecutive nodes at
+// the end of the array, leaf children consecutive ranges at the end of order.
+template <int N>
+void CompressBVHNode(const LinearBVH& binary, const QuantizedBuildItem& item, int index, QuantizedBVH<N>& q,
+    std::vector<int>& order) {
+    QuantizedBuildItem kids[N];
+    int k = ExpandQuantizedItem<N>(binary, item, kids);
+    auto isInterior = [](const QuantizedBuildItem& c) { return c.count == 0 || c.count > QBVH_MAX_LEAF; };
+    int interior = int(std::stable_partition(kids, kids + k, isInterior) - kids);
+
+    QuantizedBVHNode<N> node;
+    std::memset(&node, 0, sizeof(node));
+    Bounds3 box;
+    for (int i = 0; i < k; ++i)
+        box = uni(box, kids[i].bounds);
+    for (int axis = 0; axis < 3; ++axis) {
+        node.origin[axis] = box.pMin[axis];
+        node.exponent[axis] = int8_t(QuantizeAxis<N>(kids, k, box.pMin[axis], box.pMax[axis] - box.pMin[axis],
+            axis, node.qmin[axis], node.qmax[axis]));
+    }
+    node.childBase = int32_t(q.nodes.size());
+    node.primBase = int32_t(order.size());
+    for (int i = 0; i < k; ++i) {
+        if (i < interior) {
+            node.meta[i] = QBVH_INTERIOR;
+        }
+        else {
+            node.meta[i] = uint8_t(kids[i].count);
+            order.insert(order.end(), binary.primIndices.begin() + kids[i].first,
+                binary.primIndices.begin() + kids[i].first + kids[i].count);
+        }
+    }
+    q.nodes.resize(q.nodes.size() + interior);
+    q.nodes[index] = node;
+    for (int i = 0; i < interior; ++i)
+        CompressBVHNode<N>(binary, kids[i], node.childBase + i, q, order);
+}
+
+// Compresses a binary tree. The result does not refer to it afterwards.
+template <int N>
+QuantizedBVH<N> CompressBVH(const LinearBVH& binary) {
+    QuantizedBVH<N> q;
+    q.objects = binary.objects;
+    std::vector<int> order;
+    order.reserve(binary.primIndices.size());
+    if (!binary.empty()) {
+        const LinearBVHNode& root = binary.nodes[0];
+        QuantizedBuildItem item = { root.bounds, 0, root.nPrimitives > 0 ? root.primitivesOffset : 0,
+            root.nPrimitives };
+        q.nodes.reserve(binary.nodes.size() / (N - 1) + 1);
+        q.nodes.resize(1);
+        CompressBVHNode<N>(binary, item, 0, q, order);
+    }
+    q.oversizedOffset = int(order.size());
+    q.oversizedCount = binary.oversizedCount;
+    order.insert(order.end(), binary.primIndices.begin() + binary.oversizedOffset,
+        binary.primIndices.begin() + binary.oversizedOffset + binary.oversizedCount);
+    q.primIndices = bvh_array<int>(std::move(order));
+    return q;
+}
+
+// Decodes the child boxes and runs the slab test of IntersectChildren on them.
+template <int N>
+inline int IntersectQuantizedChildren(const QuantizedBVHNode<N>& node, const float o[3], const float inv[3],
+    const int dirIsNeg[3], float tMax, float tNear[N]) {
+    float t0[N], t1[N];
+    for (int i = 0; i < N; ++i) {
+        t0[i] = 0.0f;
+        t1[i] = std::numeric_limits<float>::max();
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        float step = QuantizedStep(node.exponent[axis]);
+        const uint8_t* qNear = dirIsNeg[axis] ? node.qmax[axis] : node.qmin[axis];
+        const uint8_t* qFar = dirIsNeg[axis] ? node.qmin[axis] : node.qmax[axis];
+        for (int i = 0; i < N; ++i) {
+            t0[i] = std::max(t0[i], (node.origin[axis] + float(qNear[i]) * step - o[axis]) * inv[axis]);
+            t1[i] = std::min(t1[i], (node.origin[axis] + float(qFar[i]) * step - o[axis]) * inv[axis]);
+        }
+    }
+    int mask = 0;
+    for (int i = 0; i < N; ++i) {
+        tNear[i] = t0[i];
+        if (node.meta[i] && t0[i] <= std::min(t1[i] * BOX_EXIT_SCALE, tMax)) mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(__AVX2__)
+template <>
+inline int IntersectQuantizedChildren<8>(const QuantizedBVHNode<8>& node, const float o[3], const float inv[3],
+    const int dirIsNeg[3], float tMax, float tNear[8]) {
+    auto load = [](const uint8_t* q) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q))));
+    };
+    __m256 t0 = _mm256_setzero_ps();
+    __m256 t1 = _mm256_set1_ps(std::numeric_limits<float>::max());
+    for (int axis = 0; axis < 3; ++axis) {
+        // q * step is exact, so a corner is rounded once, the same way the builder checked it
+        __m256 step = _mm256_set1_ps(QuantizedStep(node.exponent[axis]));
+        __m256 origin = _mm256_set1_ps(node.origin[axis]);
+        __m256 rayOrigin = _mm256_set1_ps(o[axis]);
+        __m256 rayInv = _mm256_set1_ps(inv[axis]);
+        __m256 near = _mm256_add_ps(origin, _mm256_mul_ps(load(dirIsNeg[axis] ? node.qmax[axis] : node.qmin[axis]), step));
+        __m256 far = _mm256_add_ps(origin, _mm256_mul_ps(load(dirIsNeg[axis] ? node.qmin[axis] : node.qmax[axis]), step));
+        t0 = _mm256_max_ps(t0, _mm256_mul_ps(_mm256_sub_ps(near, rayOrigin), rayInv));
+        t1 = _mm256_min_ps(t1, _mm256_mul_ps(_mm256_sub_ps(far, rayOrigin), rayInv));
+    }
+    t1 = _mm256_min_ps(_mm256_mul_ps(t1, _mm256_set1_ps(BOX_EXIT_SCALE)), _mm256_set1_ps(tMax));
+    _mm256_storeu_ps(tNear, t0);
+    __m256i used = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.meta)));
+    int valid = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(used, _mm256_setzero_si256())));
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & valid;
+}
+#endif
+
+// Same contract as TraverseWideBVH; leaf offsets are into bvh.primIndices.
+template <int N, class LeafFn>
+bool TraverseQuantizedBVH(const QuantizedBVH<N>& bvh, const ray& ray, float& tMax, LeafFn&& leaf) {
+    if (bvh.empty()) return false;
+
+    float o[3] = { ray.origin()[0], ray.origin()[1], ray.origin()[2] };
+    float inv[3] = { 1.0f / ray.direction()[0], 1.0f / ray.direction()[1], 1.0f / ray.direction()[2] };
+    int dirIsNeg[3] = { inv[0] < 0, inv[1] < 0, inv[2] < 0 };
+
+    struct Entry {
+        int child;  // Node index, or primIndices offset for leaves
+        int count;  // > 0 for leaves
+        float t;
+    };
+    Entry stack[64 * N];
+    int sp = 0;
+    Entry current = { 0, 0, 0.0f };
+    bool hitAny = false;
+    STAT_INC(traversals);
+    if (bvh.oversizedCount > 0) {
+        STAT_ADD(primitiveTests, bvh.oversizedCount);
+        hitAny = leaf(bvh.oversizedOffset, bvh.oversizedCount, tMax);
+    }
+
+    while (true) {
+        if (current.count > 0) {
+            STAT_INC(leavesVisited);
+            STAT_ADD(primitiveTests, current.count);
+            if (leaf(current.child, current.count, tMax)) {
+                STAT_INC(leafHits);
+                hitAny = true;
+            }
+        }
+        else {
+            const QuantizedBVHNode<N>& node = bvh.nodes[current.child];
+            alignas(32) float tNear[N];
+            STAT_INC(nodesVisited);
+            STAT_ADD(boxTests, N);
+            unsigned int mask = IntersectQuantizedChildren<N>(node, o, inv, dirIsNeg, tMax, tNear);
+            if (mask) {
+                // Interior children come first; a leaf starts after the leaves before it
+                auto entry = [&node](int i, float t) {
+                    if (node.meta[i] == QBVH_INTERIOR)
+                        return Entry{ node.childBase + i, 0, t };
+                    int offset = node.primBase;
+                    for (int j = 0; j < i; ++j)
+                        if (node.meta[j] != QBVH_INTERIOR) offset += node.meta[j];
+                    return Entry{ offset, node.meta[i], t };
+                };
+                int first = LowestBit(mask);
+                mask &= mask - 1;
+                if (!mask) {
+                    current = entry(first, tNear[first]);
+                    continue;
+                }
+                Entry hits[N];
+                hits[0] = entry(first, tNear[first]);
+                int n = 1;
+                while (mask) {
+                    int i = LowestBit(mask);
+                    mask &= mask - 1;
+                    Entry h = entry(i, tNear[i]);
+                    int j = n++;
+                    while (j > 0 && hits[j - 1].t < h.t) {
+                        hits[j] = hits[j - 1];
+                        --j;
+                    }
+                    hits[j] = h;
+                }
+                for (int i = 0; i < n - 1; ++i)
+                    stack[sp++] = hits[i];
+                current = hits[n - 1];
+                continue;
+            }
+        }
+
+        do {
+            if (sp == 0) return hitAny;
+            current = stack[--sp];
+        } while (current.t > tMax);
+    }
+}
+
+template <int N>
+bool QuantizedBVHIntersect(
+    const QuantizedBVH<N>& bvh,
+    const ray& ray,
+    hit_record& rec,
+    float tMin = 0.001f,
+    float tMax = std::numeric_limits<float>::max()
+) {
+    const auto& objects = *bvh.objects;
+    const int* primIndices = bvh.primIndices.data();
+    return TraverseQuantizedBVH(bvh, ray, tMax, [&](int offset, int count, float& tMax) {
+        bool hitAny = false;
+        for (int i = offset; i < offset + count; i++) {
+            if (hit_object(*objects[primIndices[i]], ray, interval(tMin, tMax), rec)) {
+                tMax = rec.t;
+                hitAny = true;
+            }
+        }
+        return hitAny;
+    });
+}
+
+#endif
@@ -0,0 +1,183 @@
+#pragma once
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+// Packet traversal of the linear BVH: RAY_PACKET_SIZE coherent rays are tested
+// against each node with one SIMD slab test. The lane count follows the
+// instruction set the file is compiled for (AVX-512: 16, AVX: 8, SSE: 4).
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+const int RAY_PACKET_SIZE = 16;
+typedef __m512 packet_float;
+inline packet_float pf_load(const float* p) { return _mm512_load_ps(p); }
+inline packet_float pf_set1(float v) { return _mm512_set1_ps(v); }
+inline packet_float pf_sub(packet_float a, packet_float b) { return _mm512_sub_ps(a, b); }
+inline packet_float pf_mul(packet_float a, packet_float b) { return _mm512_mul_ps(a, b); }
+inline packet_float pf_min(packet_float a, packet_float b) { return _mm512_min_ps(a, b); }
+inline packet_float pf_max(packet_float a, packet_float b) { return _mm512_max_ps(a, b); }
+inline int pf_slab_mask(packet_float tnear, packet_float tfar, packet_float tmax) {
+    __mmask16 m = _mm512_cmp_ps_mask(tnear, tfar, _CMP_LE_OQ);
+    m &= _mm512_cmp_ps_mask(tfar, _mm512_setzero_ps(), _CMP_GT_OQ);
+    m &= _mm512_cmp_ps_mask(tnear, tmax, _CMP_LT_OQ);
+    return int(m);
+}
+#elif defined(__AVX__)
+#include <immintrin.h>
+const int RAY_PACKET_SIZE = 8;
+typedef __m256 packet_float;
+inline packet_float pf_load(const float* p) { return _mm256_load_ps(p); }
+inline packet_float pf_set1(float v) { return _mm256_set1_ps(v); }
+inline packet_float pf_sub(packet_float a, packet_float b) { return _mm256_sub_ps(a, b); }
+inline packet_float pf_mul(packet_float a, packet_float b) { return _mm256_mul_ps(a, b); }
+inline packet_float pf_min(packet_float a, packet_float b) { return _mm256_min_ps(a, b); }
+inline packet_float pf_max(packet_float a, packet_float b) { return _mm256_max_ps(a, b); }
+inline int pf_slab_mask(packet_float tnear, packet_float tfar, packet_float tmax) {
+    __m256 m = _mm256_and_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ),
+        _mm256_cmp_ps(tfar, _mm256_setzero_ps(), _CMP_GT_OQ));
+    m = _mm256_and_ps(m, _mm256_cmp_ps(tnear, tmax, _CMP_LT_OQ));
+    return _mm256_movemask_ps(m);
+}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+const int RAY_PACKET_SIZE = 4;
+typedef __m128 packet_float;
+inline packet_float pf_load(const float* p) { return _mm_load_ps(p); }
+inline packet_float pf_set1(float v) { return _mm_set1_ps(v); }
+inline packet_float pf_sub(packet_float a, packet_float b) { return _mm_sub_ps(a, b); }
+inline packet_float pf_mul(packet_float a, packet_float b) { return _mm_mul_ps(a, b); }
+inline packet_float pf_min(packet_float a, packet_float b) { return _mm_min_ps(a, b); }
+inline packet_float pf_max(packet_float a, packet_float b) { return _mm_max_ps(a, b); }
+inline int pf_slab_mask(packet_float tnear, packet_float tfar, packet_float tmax) {
+    __m128 m = _mm_and_ps(_mm_cmple_ps(tnear, tfar), _mm_cmpgt_ps(tfar, _mm_setzero_ps()));
+    m = _mm_and_ps(m, _mm_cmplt_ps(tnear, tmax));
+    return _mm_movemask_ps(m);
+}
+#else
+// Portable fallback, the compiler may still vectorize the lane loops.
+const int RAY_PACKET_SIZE = 4;
+struct packet_float { float v[RAY_PACKET_SIZE]; };
+inline packet_float pf_load(const float* p) { packet_float r; for (int i = 0; i < RAY_PACKET_SIZE; ++i) r.v[i] = p[i]; return r; }
+inline packet_float pf_set1(float x) { packet_float r; for (int i = 0; i < RAY_PACKET_SIZE; ++i) r.v[i] = x; return r; }
+inline packet_float pf_sub(packet_float a, packet_float b) { for (int i = 0; i < RAY_PACKET_SIZE; ++i) a.v[i] -= b.v[i]; return a; }
+inline packet_float pf_mul(packet_float a, packet_float b) { for (int i = 0; i < RAY_PACKET_SIZE; ++i) a.v[i] *= b.v[i]; return a; }
+inline packet_float pf_min(packet_float a, packet_float b) { for (int i = 0; i < RAY_PACKET_SIZE; ++i) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return a; }
+inline packet_float pf_max(packet_float a, packet_float b) { for (int i = 0; i < RAY_PACKET_SIZE; ++i) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+inline int pf_slab_mask(packet_float tnear, packet_float tfar, packet_float tmax) {
+    int m = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+        if (tnear.v[i] <= tfar.v[i] && tfar.v[i] > 0 && tnear.v[i] < tmax.v[i]) m |= 1 << i;
+    return m;
+}
+#endif
+
+// Rays of a packet in SoA form with precomputed inverse directions. Unused
+// lanes keep tMax = -inf so they never pass a slab test.
+struct alignas(64) ray_packet {
+    float ox[RAY_PACKET_SIZE], oy[RAY_PACKET_SIZE], oz[RAY_PACKET_SIZE];
+    float idx[RAY_PACKET_SIZE], idy[RAY_PACKET_SIZE], idz[RAY_PACKET_SIZE];
+    float tMax[RAY_PACKET_SIZE];
+    ray rays[RAY_PACKET_SIZE];
+    int count = 0;
+
+    ray_packet() {
+        for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+            ox[i] = oy[i] = oz[i] = 0;
+            idx[i] = idy[i] = idz[i] = 1;
+            tMax[i] = -std::numeric_limits<float>::infinity();
+        }
+    }
+
+    void set(int lane, const ray& r, float tmax = std::numeric_limits<float>::max()) {
+        rays[lane] = r;
+        ox[lane] = r.origin().x(); oy[lane] = r.origin().y(); oz[lane] = r.origin().z();
+        idx[lane] = 1.0f / r.direction().x();
+        idy[lane] = 1.0f / r.direction().y();
+        idz[lane] = 1.0f / r.direction().z();
+        tMax[lane] = tmax;
+        count = std::max(count, lane + 1);
+    }
+
+    // Bit i is set when lane i enters the box before its current tMax.
+    int IntersectBox(const Bounds3& b) const {
+        packet_float tx0 = pf_mul(pf_sub(pf_set1(b.pMin[0]), pf_load(ox)), pf_load(idx));
+        packet_float tx1 = pf_mul(pf_sub(pf_set1(b.pMax[0]), pf_load(ox)), pf_load(idx));
+        packet_float ty0 = pf_mul(pf_sub(pf_set1(b.pMin[1]), pf_load(oy)), pf_load(idy));
+        packet_float ty1 = pf_mul(pf_sub(pf_set1(b.pMax[1]), pf_load(oy)), pf_load(idy));
+        packet_float tz0 = pf_mul(pf_sub(pf_set1(b.pMin[2]), pf_load(oz)), pf_load(idz));
+        packet_float tz1 = pf_mul(pf_sub(pf_set1(b.pMax[2]), pf_load(oz)), pf_load(idz));
+        packet_float tnear = pf_max(pf_max(pf_min(tx0, tx1), pf_min(ty0, ty1)), pf_min(tz0, tz1));
+        packet_float tfar = pf_mul(pf_min(pf_min(pf_max(tx0, tx1), pf_max(ty0, ty1)), pf_max(tz0, tz1)),
+            pf_set1(BOX_EXIT_SCALE));
+        return pf_slab_mask(tnear, tfar, pf_load(tMax));
+    }
+};
+
+// Packet traversal of the linear BVH. leaf(lane, offset, count, tMax) tests a
+// leaf range for one active lane and shrinks its tMax on a hit. Returns the mask
+// of lanes that hit something. Child order follows the direction of the first
+// lane, which is right for every lane of a coherent primary packet.
+template <class LaneLeafFn>
+int TraversePacket(const LinearBVH& bvh, ray_packet& packet, LaneLeafFn&& leaf) {
+    if (bvh.empty() || packet.count == 0) return 0;
+    const LinearBVHNode* nodes = bvh.nodes.data();
+    int dirIsNeg[3] = { packet.idx[0] < 0, packet.idy[0] < 0, packet.idz[0] < 0 };
+
+    int hitMask = 0;
+    // Oversized primitives kept out of the tree, tested once per lane up front
+    if (bvh.oversizedCount > 0) {
+        for (int lane = 0; lane < packet.count; ++lane) {
+            if (leaf(lane, bvh.oversizedOffset, bvh.oversizedCount, packet.tMax[lane]))
+                hitMask |= 1 << lane;
+        }
+    }
+    int toVisit[64];
+    int toVisitOffset = 0;
+    int current = 0;
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        int mask = packet.IntersectBox(node.bounds);
+        if (mask) {
+            if (node.nPrimitives > 0) {
+                for (int lane = 0; lane < packet.count; ++lane) {
+                    if ((mask & (1 << lane)) && leaf(lane, node.primitivesOffset, int(node.nPrimitives), packet.tMax[lane]))
+                        hitMask |= 1 << lane;
+                }
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+            else if (dirIsNeg[node.axis]) {
+                toVisit[toVisitOffset++] = current + 1;
+                current = node.secondChildOffset;
+            }
+            else {
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (toVisitOffset == 0) break;
+            current = toVisit[--toVisitOffset];
+        }
+    }
+    return hitMask;
+}
+
+// Closest hit for every lane of the packet. recs[i] is valid when bit i of the
+// returned mask is set.
+inline int IntersectPacket(const LinearBVH& bvh, ray_packet& packet, hit_record* recs, float tMin = 0.001f) {
+    const auto& objects = *bvh.objects;
+    const int* primIndices = bvh.primIndices.data();
+    return TraversePacket(bvh, packet, [&](int lane, int offset, int count, float& tMax) {
+        bool hitAny = false;
+        for (int i = offset; i < offset + count; ++i) {
+            if (hit_object(*objects[primIndices[i]], packet.rays[lane], interval(tMin, tMax), recs[lane])) {
+                tMax = recs[lane].t;
+                hitAny = true;
+            }
+        }
+        return hitAny;
+    });
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 
 #include <iostream>
 #include <limits>
@@ -22,9 +24,68 @@ const double pi = 3.1415926535897932385;
 inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
+// PCG32 generator (pcg-random.org): 64-bit LCG state with a permuted 32-bit output.
+class pcg32 {
+public:
+    pcg32() { seed(0, 0); }
+
+    void seed(uint64_t initstate, uint64_t initseq) {
+        state = 0;
+        inc = (initseq << 1u) | 1u;
+        next();
+        state += initstate;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+private:
+    uint64_t state, inc;
+};
+
+inline uint64_t mix64(uint64_t x) {
+    // SplitMix64 finalizer, turns consecutive counters into unrelated seeds.
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t mix_float(uint64_t key, float v) {
+    // Mixes the bits of v into key, for hashes of scene content.
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return mix64(key ^ bits);
+}
+
+inline pcg32& random_engine() {
+    // One engine per thread, so worker threads never share generator state.
+    thread_local pcg32 engine;
+    return engine;
+}
+
+inline void seed_random(uint64_t seed) {
+    // Plain seeding, used for scene generation.
+    random_engine().seed(mix64(seed), 0);
+}
+
+inline void seed_random(uint32_t seed, uint32_t pixel, uint32_t sample, uint32_t bounce) {
+    // Counter-based seeding: the numbers drawn at one path vertex only depend on
+    // (seed, pixel, sample, bounce), not on the thread or on earlier draws.
+    uint64_t key = mix64((uint64_t(pixel) << 32) | sample) ^ mix64((uint64_t(bounce) << 32) | seed);
+    random_engine().seed(key, seed);
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    return random_engine().next() * (1.0 / 4294967296.0);
 }
 
 inline double random_double(double min, double max) {
@@ -38,4 +99,5 @@ inline double random_double(double min, double max) {
 #include "vec3.h"
 #include "hittable.h"
 #include"fasterStructrue.h"
+#include "sphere.h"
 #endif
\ No newline at end of file
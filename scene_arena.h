@@ -0,0 +1,75 @@
+#pragma once
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+// Scene-lifetime arena. Objects and materials are constructed back to back in
+// large blocks instead of one heap allocation (plus control block) each, and
+// are destroyed together. make() returns shared_ptrs that alias one shared
+// owner of the storage, so they plug into hittable_list and sphere as before:
+// the storage lives until the arena and every pointer into it are gone, and
+// no per-object reference count exists.
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+class scene_arena {
+public:
+    explicit scene_arena(size_t block_bytes = 1 << 20) : storage(std::make_shared<blocks>(block_bytes)) {}
+
+    template <class T, class... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types need their own allocation");
+        void* p = storage->allocate(sizeof(T), alignof(T));
+        T* object = new (p) T(std::forward<Args>(args)...);
+        storage->destructors.push_back({ object, [](void* o) { static_cast<T*>(o)->~T(); } });
+        return std::shared_ptr<T>(storage, object);
+    }
+
+    size_t MemoryBytes() const { return storage->reserved; }
+
+private:
+    struct destructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    struct blocks {
+        size_t block_bytes;
+        size_t used = 0;      // Bytes used in the last block
+        size_t reserved = 0;  // Bytes of all blocks
+        std::vector<std::unique_ptr<char[]>> list;
+        std::vector<destructor> destructors;
+
+        explicit blocks(size_t block_bytes) : block_bytes(block_bytes) {}
+
+        ~blocks() {
+            for (size_t i = destructors.size(); i-- > 0;)
+                destructors[i].destroy(destructors[i].object);
+        }
+
+        // new char[] is aligned for any fundamental type, so a fresh block
+        // starts at offset 0 for everything make() can construct.
+        void* allocate(size_t bytes, size_t align) {
+            size_t offset = (used + align - 1) & ~(align - 1);
+            if (list.empty() || offset + bytes > current_size) {
+                current_size = std::max(block_bytes, bytes);  // Oversized objects get a block of their own
+                list.emplace_back(new char[current_size]);
+                reserved += current_size;
+                offset = 0;
+            }
+            used = offset + bytes;
+            return list.back().get() + offset;
+        }
+
+    private:
+        size_t current_size = 0;
+    };
+
+    std::shared_ptr<blocks> storage;
+};
+
+#endif
@@ -0,0 +1,75 @@
+// scene_convert.cpp : converts scenes between the text and the binary format.
+//
+// Usage: scene_convert <input> <output>
+//        scene_convert --generate <final|100k|1m|10m> <output>
+//
+// The input may be either form. The output is text when its name ends in
+// ".txt" and binary otherwise. --generate writes one of the seeded benchmark
+// scenes.
+#include <chrono>
+#include <cstring>
+#include <string>
+#include "rtweekend.h"
+
+#include "scene_file.h"
+#include "scenes.h"
+
+static bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Copies a loaded scene back into arrays.
+static scene_data to_scene_data(const scene_file& file) {
+    scene_data data;
+    data.lookfrom = file.lookfrom();
+    data.lookat = file.lookat();
+    data.vfov = file.vfov();
+    for (int i = 0; i < file.materialCount(); ++i)
+        data.materials.push_back(file.getMaterial(i));
+    int n = file.size();
+    data.cx.assign(file.cx(), file.cx() + n);
+    data.cy.assign(file.cy(), file.cy() + n);
+    data.cz.assign(file.cz(), file.cz() + n);
+    data.radius.assign(file.radius(), file.radius() + n);
+    data.materialId.assign(file.materialId(), file.materialId() + n);
+    return data;
+}
+
+int main(int argc, char** argv) {
+    scene_data data;
+    std::string output;
+    auto start = std::chrono::steady_clock::now();
+    if (argc == 4 && !std::strcmp(argv[1], "--generate")) {
+        scene_desc scene;
+        if (!named_scene(argv[2], scene)) {
+            std::cerr << "Unknown scene " << argv[2] << "\n";
+            return 1;
+        }
+        if (!scene_data_from_world(scene, data)) {
+            std::cerr << "Scene " << argv[2] << " has objects the scene format cannot store\n";
+            return 1;
+        }
+        output = argv[3];
+    }
+    else if (argc == 3) {
+        scene_file file;
+        if (!file.open(argv[1]))
+            return 1;
+        data = to_scene_data(file);
+        output = argv[2];
+    }
+    else {
+        std::cerr << "Usage: scene_convert <input> <output>\n"
+                  << "       scene_convert --generate <final|100k|1m|10m> <output>\n";
+        return 1;
+    }
+
+    bool text = ends_with(output, ".txt");
+    if (!(text ? write_scene_text(output, data) : write_scene_binary(output, data))) {
+        std::cerr << "Cannot write " << output << "\n";
+        return 1;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Wrote " << data.size() << " spheres and " << data.materials.size() << " materials to " << output
+              << (text ? " (text)" : " (binary)") << " in " << ms << " ms\n";
+}
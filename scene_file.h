@@ -0,0 +1,410 @@
+#pragma once
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+// Scene files for all-sphere scenes. The text form is for writing scenes by hand:
+//
+//   # comment
+//   camera <lookfrom x y z> <lookat x y z> <vfov>
+//   material <name> lambertian <r g b>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <refraction index>
+//   sphere <center x y z> <radius> <material name>
+//
+// The binary form holds the same scene as SoA arrays at 64 byte aligned offsets,
+// padded like sphere_soup expects. scene_file maps it and the soup reads the
+// arrays in place, so loading costs page faults instead of one allocation per
+// sphere. A text file is encoded into the same layout in memory.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rtweekend.h"
+#include "material.h"
+#include "mapped_file.h"
+#include "scene_arena.h"
+#include "scenes.h"
+#include "sphere_soup.h"
+
+struct scene_material {
+    material_type kind;
+    color albedo;       // lambertian, metal
+    float fuzz;         // metal
+    float refraction;   // dielectric
+};
+
+// A scene as plain arrays, for converting and writing.
+struct scene_data {
+    point3 lookfrom = point3(13, 2, 3);
+    point3 lookat = point3(0, 0, 0);
+    float vfov = 20.f;
+    std::vector<scene_material> materials;
+    std::vector<float> cx, cy, cz, radius;
+    std::vector<uint32_t> materialId;
+
+    int size() const { return int(cx.size()); }
+    void add_sphere(const point3& center, float r, uint32_t material) {
+        cx.push_back(center.x());
+        cy.push_back(center.y());
+        cz.push_back(center.z());
+        radius.push_back(r);
+        materialId.push_back(material);
+    }
+};
+
+struct scene_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t sphere_count;
+    uint32_t material_count;
+    uint32_t padded_count;      // Entries of every sphere array
+    float    lookfrom[3];
+    float    lookat[3];
+    float    vfov;
+    uint32_t reserved;
+    uint64_t materials_offset;  // material_count records
+    uint64_t cx_offset, cy_offset, cz_offset, radius_offset, material_id_offset;
+    uint64_t file_size;
+};
+
+struct scene_file_material {
+    uint32_t kind;          // material_type
+    float    params[4];     // albedo and fuzz, or the refraction index
+};
+
+const char SCENE_FILE_MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t SCENE_FILE_VERSION = 1;
+const uint32_t SCENE_FILE_PADDING = 16;  // At least soup_lanes::width for every instruction set
+const uint64_t SCENE_FILE_ALIGNMENT = 64;
+static_assert(soup_lanes::width <= int(SCENE_FILE_PADDING), "scene files are padded for the soup kernel");
+
+inline uint64_t scene_file_align(uint64_t offset) {
+    return (offset + SCENE_FILE_ALIGNMENT - 1) & ~(SCENE_FILE_ALIGNMENT - 1);
+}
+
+// Header with every offset filled in for `data`.
+inline scene_file_header make_scene_file_header(const scene_data& data) {
+    scene_file_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, SCENE_FILE_MAGIC, sizeof(h.magic));
+    h.version = SCENE_FILE_VERSION;
+    h.sphere_count = uint32_t(data.size());
+    h.material_count = uint32_t(data.materials.size());
+    h.padded_count = h.sphere_count + SCENE_FILE_PADDING;
+    for (int i = 0; i < 3; ++i) {
+        h.lookfrom[i] = data.lookfrom[i];
+        h.lookat[i] = data.lookat[i];
+    }
+    h.vfov = data.vfov;
+
+    uint64_t floats = uint64_t(h.padded_count) * sizeof(float);
+    h.materials_offset = scene_file_align(sizeof(h));
+    h.cx_offset = scene_file_align(h.materials_offset + h.material_count * sizeof(scene_file_material));
+    h.cy_offset = scene_file_align(h.cx_offset + floats);
+    h.cz_offset = scene_file_align(h.cy_offset + floats);
+    h.radius_offset = scene_file_align(h.cz_offset + floats);
+    h.material_id_offset = scene_file_align(h.radius_offset + floats);
+    h.file_size = h.material_id_offset + uint64_t(h.padded_count) * sizeof(uint32_t);
+    return h;
+}
+
+// Writes the binary form of `data` into `out`, which holds header.file_size bytes.
+inline void encode_scene_file(const scene_data& data, const scene_file_header& h, char* out) {
+    std::memset(out, 0, size_t(h.file_size));
+    std::memcpy(out, &h, sizeof(h));
+    scene_file_material* materials = reinterpret_cast<scene_file_material*>(out + h.materials_offset);
+    for (uint32_t i = 0; i < h.material_count; ++i) {
+        const scene_material& m = data.materials[i];
+        materials[i].kind = uint32_t(m.kind);
+        if (m.kind == material_type::dielectric) {
+            materials[i].params[0] = m.refraction;
+        }
+        else {
+            for (int c = 0; c < 3; ++c)
+                materials[i].params[c] = m.albedo[c];
+            materials[i].params[3] = m.fuzz;
+        }
+    }
+    // Padding entries can never be hit: NaN centers, zero radius
+    auto copy = [&](uint64_t offset, const std::vector<float>& values, float pad) {
+        float* dst = reinterpret_cast<float*>(out + offset);
+        std::memcpy(dst, values.data(), values.size() * sizeof(float));
+        std::fill(dst + values.size(), dst + h.padded_count, pad);
+    };
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    copy(h.cx_offset, data.cx, nan);
+    copy(h.cy_offset, data.cy, nan);
+    copy(h.cz_offset, data.cz, nan);
+    copy(h.radius_offset, data.radius, 0.0f);
+    std::memcpy(out + h.material_id_offset, data.materialId.data(), data.materialId.size() * sizeof(uint32_t));
+}
+
+inline bool write_scene_binary(const std::string& path, const scene_data& data) {
+    scene_file_header h = make_scene_file_header(data);
+    mapped_file file;
+    if (!file.create(path, size_t(h.file_size)))
+        return false;
+    encode_scene_file(data, h, file.data());
+    return file.flush();
+}
+
+inline bool write_scene_text(const std::string& path, const scene_data& data) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    // %.9g round-trips every float exactly
+    std::fprintf(f, "camera %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g\n", data.lookfrom.x(), data.lookfrom.y(),
+        data.lookfrom.z(), data.lookat.x(), data.lookat.y(), data.lookat.z(), data.vfov);
+    for (size_t i = 0; i < data.materials.size(); ++i) {
+        const scene_material& m = data.materials[i];
+        if (m.kind == material_type::lambertian)
+            std::fprintf(f, "material m%zu lambertian %.9g %.9g %.9g\n", i, m.albedo.x(), m.albedo.y(), m.albedo.z());
+        else if (m.kind == material_type::metal)
+            std::fprintf(f, "material m%zu metal %.9g %.9g %.9g %.9g\n", i, m.albedo.x(), m.albedo.y(), m.albedo.z(),
+                m.fuzz);
+        else
+            std::fprintf(f, "material m%zu dielectric %.9g\n", i, m.refraction);
+    }
+    for (int i = 0; i < data.size(); ++i) {
+        std::fprintf(f, "sphere %.9g %.9g %.9g %.9g m%u\n", data.cx[i], data.cy[i], data.cz[i], data.radius[i],
+            data.materialId[i]);
+    }
+    bool ok = !std::ferror(f);
+    return (std::fclose(f) == 0) && ok;
+}
+
+// Parses the text form. Errors are reported with their line number.
+inline bool read_scene_text(const std::string& path, scene_data& data) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << path << ": cannot open\n";
+        return false;
+    }
+    data = scene_data();
+    std::unordered_map<std::string, uint32_t> names;
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword) || keyword[0] == '#')
+            continue;
+        bool ok = false;
+        if (keyword == "camera") {
+            float v[7];
+            ok = bool(words >> v[0] >> v[1] >> v[2] >> v[3] >> v[4] >> v[5] >> v[6]);
+            data.lookfrom = point3(v[0], v[1], v[2]);
+            data.lookat = point3(v[3], v[4], v[5]);
+            data.vfov = v[6];
+        }
+        else if (keyword == "material") {
+            std::string name, type;
+            scene_material m{ material_type::lambertian, color(0, 0, 0), 0.0f, 1.0f };
+            float r = 0, g = 0, b = 0;
+            words >> name >> type;
+            if (type == "lambertian") {
+                ok = bool(words >> r >> g >> b);
+            }
+            else if (type == "metal") {
+                m.kind = material_type::metal;
+                ok = bool(words >> r >> g >> b >> m.fuzz);
+            }
+            else if (type == "dielectric") {
+                m.kind = material_type::dielectric;
+                ok = bool(words >> m.refraction);
+            }
+            m.albedo = color(r, g, b);
+            if (ok && !names.emplace(name, uint32_t(data.materials.size())).second) {
+                std::cerr << path << ":" << number << ": material " << name << " defined twice\n";
+                return false;
+            }
+            data.materials.push_back(m);
+        }
+        else if (keyword == "sphere") {
+            float x, y, z, r;
+            std::string name;
+            ok = bool(words >> x >> y >> z >> r >> name);
+            if (ok) {
+                auto found = names.find(name);
+                if (found == names.end()) {
+                    std::cerr << path << ":" << number << ": unknown material " << name << "\n";
+                    return false;
+                }
+                data.add_sphere(point3(x, y, z), std::fmax(0.0f, r), found->second);
+            }
+        }
+        if (!ok) {
+            std::cerr << path << ":" << number << ": cannot parse \"" << line << "\"\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Scene of spheres with built-in materials as arrays. Fails for anything else.
+inline bool scene_data_from_world(const scene_desc& scene, scene_data& data) {
+    data = scene_data();
+    data.lookfrom = scene.lookfrom;
+    data.lookat = scene.lookat;
+    data.vfov = scene.vfov;
+    std::unordered_map<const material*, uint32_t> ids;
+    for (const auto& object : scene.world.objects) {
+        const sphere* s = dynamic_cast<const sphere*>(object.get());
+        if (!s)
+            return false;
+        const material* mat = s->getMaterial().get();
+        auto found = ids.find(mat);
+        if (found == ids.end()) {
+            scene_material m{ mat->kind, color(0, 0, 0), 0.0f, 1.0f };
+            if (mat->kind == material_type::lambertian)
+                m.albedo = static_cast<const lambertian*>(mat)->getAlbedo();
+            else if (mat->kind == material_type::metal) {
+                m.albedo = static_cast<const metal*>(mat)->getAlbedo();
+                m.fuzz = static_cast<const metal*>(mat)->getFuzz();
+            }
+            else if (mat->kind == material_type::dielectric)
+                m.refraction = float(static_cast<const dielectric*>(mat)->refractionIndex());
+            else
+                return false;
+            found = ids.emplace(mat, uint32_t(data.materials.size())).first;
+            data.materials.push_back(m);
+        }
+        data.add_sphere(s->getCenter(), s->getRadius(), found->second);
+    }
+    return true;
+}
+
+inline shared_ptr<material> make_material(const scene_material& m, scene_arena& arena) {
+    switch (m.kind) {
+    case material_type::metal:
+        return arena.make<metal>(m.albedo, m.fuzz);
+    case material_type::dielectric:
+        return arena.make<dielectric>(m.refraction);
+    default:
+        return arena.make<lambertian>(m.albedo);
+    }
+}
+
+// A loaded scene: the mapped binary file, or a text file encoded into memory.
+class scene_file {
+public:
+    // Opens either form; the binary one is recognized by its magic.
+    bool open(const std::string& path) {
+        close();
+        if (!file.open_read(path)) {
+            std::cerr << path << ": cannot open\n";
+            return false;
+        }
+        if (file.size() >= sizeof(SCENE_FILE_MAGIC)
+            && std::memcmp(file.data(), SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC)) == 0) {
+            base = file.data();
+            if (!valid(file.size())) {
+                std::cerr << path << ": not a valid version " << SCENE_FILE_VERSION << " scene file\n";
+                close();
+                return false;
+            }
+            return true;
+        }
+        file.close();
+        scene_data data;
+        if (!read_scene_text(path, data))
+            return false;
+        scene_file_header h = make_scene_file_header(data);
+        memory.assign(size_t((h.file_size + sizeof(uint64_t) - 1) / sizeof(uint64_t)), 0);
+        base = reinterpret_cast<const char*>(memory.data());
+        encode_scene_file(data, h, reinterpret_cast<char*>(memory.data()));
+        return true;
+    }
+
+    bool is_open() const { return base != nullptr; }
+
+    void close() {
+        file.close();
+        memory.clear();
+        memory.shrink_to_fit();
+        base = nullptr;
+    }
+
+    const scene_file_header& header() const { return *reinterpret_cast<const scene_file_header*>(base); }
+    int size() const { return int(header().sphere_count); }
+    point3 lookfrom() const { return point3(header().lookfrom[0], header().lookfrom[1], header().lookfrom[2]); }
+    point3 lookat() const { return point3(header().lookat[0], header().lookat[1], header().lookat[2]); }
+    float vfov() const { return header().vfov; }
+
+    const float* cx() const { return array<float>(header().cx_offset); }
+    const float* cy() const { return array<float>(header().cy_offset); }
+    const float* cz() const { return array<float>(header().cz_offset); }
+    const float* radius() const { return array<float>(header().radius_offset); }
+    const uint32_t* materialId() const { return array<uint32_t>(header().material_id_offset); }
+    int materialCount() const { return int(header().material_count); }
+
+    scene_material getMaterial(int i) const {
+        const scene_file_material& record = array<scene_file_material>(header().materials_offset)[i];
+        const float* p = record.params;
+        material_type kind = material_type(record.kind);
+        if (kind == material_type::dielectric)
+            return scene_material{ kind, color(0, 0, 0), 0.0f, p[0] };
+        return scene_material{ kind, color(p[0], p[1], p[2]), p[3], 1.0f };
+    }
+
+    Bounds3 bounds(int i) const {
+        float r = radius()[i];
+        point3 c(cx()[i], cy()[i], cz()[i]);
+        return Bounds3(c - vec3(r, r, r), c + vec3(r, r, r));
+    }
+
+    // Builds the material table in `arena` and points the soup at the arrays.
+    // `order` is the soup order (LinearBVH::primIndices, or null for file order)
+    // and has to outlive the soup.
+    void make_soup(const bvh_array<int>* order, scene_arena& arena, sphere_soup& soup) const {
+        soup = sphere_soup();
+        for (int i = 0; i < materialCount(); ++i) {
+            soup.materials.push_back(make_material(getMaterial(i), arena));
+        }
+        soup.View(cx(), cy(), cz(), radius(), materialId(), size(), order ? order->data() : nullptr);
+    }
+
+private:
+    mapped_file file;
+    std::vector<uint64_t> memory;   // Encoded text scene
+    const char* base = nullptr;
+
+    template <class T>
+    const T* array(uint64_t offset) const { return reinterpret_cast<const T*>(base + offset); }
+
+    bool valid(size_t bytes) const {
+        if (bytes < sizeof(scene_file_header))
+            return false;
+        const scene_file_header& h = header();
+        if (h.version != SCENE_FILE_VERSION || h.file_size != bytes
+            || h.sphere_count > uint32_t(std::numeric_limits<int>::max()) - SCENE_FILE_PADDING
+            || h.padded_count != h.sphere_count + SCENE_FILE_PADDING)
+            return false;
+        uint64_t floats = uint64_t(h.padded_count) * sizeof(float);
+        const uint64_t ends[] = {
+            h.materials_offset + uint64_t(h.material_count) * sizeof(scene_file_material),
+            h.cx_offset + floats, h.cy_offset + floats, h.cz_offset + floats, h.radius_offset + floats,
+            h.material_id_offset + uint64_t(h.padded_count) * sizeof(uint32_t) };
+        for (uint64_t end : ends)
+            if (end > bytes)
+                return false;
+        const uint64_t offsets[] = { h.materials_offset, h.cx_offset, h.cy_offset, h.cz_offset, h.radius_offset,
+            h.material_id_offset };
+        for (uint64_t offset : offsets)
+            if (offset % SCENE_FILE_ALIGNMENT)
+                return false;
+        const uint32_t* ids = materialId();
+        for (uint32_t i = 0; i < h.sphere_count; ++i)
+            if (ids[i] >= h.material_count)
+                return false;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#pragma once
+#ifndef SCENES_H
+#define SCENES_H
+
+// Seeded test scenes shared by the renderer and the benchmark. The same seed
+// always builds the same scene, on every platform and thread count.
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include "rtweekend.h"
+#include "accelerator.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "scene_arena.h"
+#include "sphere.h"
+
+// Spheres and materials of a scene live in its arena; the world's pointers
+// keep the arena storage alive on their own.
+struct scene_desc {
+    std::string name;
+    scene_arena arena;
+    hittable_list world;
+    point3 lookfrom;
+    point3 lookat;
+    float vfov;
+    // Made by accelerate() once the world is complete. It points into
+    // world.objects, so the scene is not moved afterwards.
+    std::unique_ptr<accelerator> accel;
+
+    const accelerator& accelerate(thread_pool* pool = nullptr, const accel_costs& costs = host_accel_costs(),
+        bool compressed = false) {
+        accel = std::make_unique<accelerator>();
+        accel->compressed = compressed;
+        accel->build(world.objects, pool, costs);
+        return *accel;
+    }
+};
+
+// The cover scene of "Ray Tracing in One Weekend". Seed 0 gives the scene the
+// renderer has always drawn.
+inline scene_desc final_scene(uint64_t seed = 0) {
+    seed_random(seed);
+    scene_desc scene;
+    scene.name = "final";
+    scene.lookfrom = point3(13, 2, 3);
+    scene.lookat = point3(0, 0, 0);
+    scene.vfov = 20.f;
+    hittable_list& world = scene.world;
+    scene_arena& arena = scene.arena;
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = arena.make<lambertian>(albedo);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = arena.make<metal>(albedo, fuzz);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
+                }
+                else {
+                    // glass
+                    sphere_material = arena.make<dielectric>(1.5);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+    auto ground_material = arena.make<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    auto material1 = arena.make<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = arena.make<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = arena.make<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
+    return scene;
+}
+
+// `count` small spheres scattered over a square field with about one sphere per
+// unit of area, seen from above one corner. Materials come from a small shared
+// palette, so memory grows with the geometry only.
+inline scene_desc sphere_field(const std::string& name, int count, uint64_t seed) {
+    seed_random(seed);
+    scene_desc scene;
+    scene.name = name;
+    float half = 0.5f * std::sqrt(float(count));
+    scene.lookfrom = point3(1.1f * half, 0.35f * half + 2, 1.1f * half);
+    scene.lookat = point3(0, 0, 0);
+    scene.vfov = 40.f;
+
+    scene_arena& arena = scene.arena;
+    std::vector<shared_ptr<material>> palette;
+    for (int i = 0; i < 12; ++i)
+        palette.push_back(arena.make<lambertian>(color::random() * color::random()));
+    for (int i = 0; i < 3; ++i)
+        palette.push_back(arena.make<metal>(color::random(0.5, 1), random_double(0, 0.5)));
+    palette.push_back(arena.make<dielectric>(1.5));
+
+    hittable_list& world = scene.world;
+    world.objects.reserve(size_t(count) + 1);
+    for (int i = 0; i < count; ++i) {
+        float radius = float(random_double(0.1, 0.3));
+        point3 center(random_double(-half, half), radius, random_double(-half, half));
+        world.add(arena.make<sphere>(center, radius, palette[int(random_double() * palette.size())]));
+    }
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, arena.make<lambertian>(color(0.5, 0.5, 0.5))));
+    return scene;
+}
+
+// `instances` copies of one cluster of `cluster` spheres, each turned, scaled
+// and moved on its own and recoloured from the palette, over the ground
+// sphere. The cluster is built into its BVH once; the world holds only the
+// instances, so memory grows with cluster + instances, not their product.
+inline scene_desc instanced_field(const std::string& name, int cluster, int instances, uint64_t seed) {
+    seed_random(seed);
+    scene_desc scene;
+    scene.name = name;
+    float half = 2.5f * std::sqrt(float(instances));
+    scene.lookfrom = point3(1.1f * half, 0.35f * half + 2, 1.1f * half);
+    scene.lookat = point3(0, 0, 0);
+    scene.vfov = 40.f;
+
+    scene_arena& arena = scene.arena;
+    std::vector<shared_ptr<material>> palette;
+    for (int i = 0; i < 12; ++i)
+        palette.push_back(arena.make<lambertian>(color::random() * color::random()));
+    for (int i = 0; i < 3; ++i)
+        palette.push_back(arena.make<metal>(color::random(0.5, 1), random_double(0, 0.5)));
+    palette.push_back(arena.make<dielectric>(1.5));
+
+    // A heap of small spheres about two units across, resting on y = 0
+    std::vector<shared_ptr<hittable>> parts;
+    parts.reserve(cluster);
+    for (int i = 0; i < cluster; ++i) {
+        float radius = float(random_double(0.05, 0.15));
+        vec3 offset = std::cbrt(random_double()) * random_unit_vector();
+        point3 center(offset.x(), std::fabs(offset.y()) * 0.5f + radius, offset.z());
+        parts.push_back(arena.make<sphere>(center, radius, palette[0]));
+    }
+    auto heap = arena.make<geometry_bvh>(std::move(parts));
+
+    hittable_list& world = scene.world;
+    world.objects.reserve(size_t(instances) + 1);
+    for (int i = 0; i < instances; ++i) {
+        float s = float(random_double(0.5, 1.5));
+        point3 position(random_double(-half, half), 0, random_double(-half, half));
+        transform to_world = transform::translate(position) * transform::rotate_y(float(random_double(0, 360)))
+            * transform::scale(s);
+        world.add(arena.make<instance>(heap, to_world, palette[int(random_double() * palette.size())]));
+    }
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, arena.make<lambertian>(color(0.5, 0.5, 0.5))));
+    return scene;
+}
+
+// The benchmark scenes by name: "final", "100k", "1m", "10m" and "inst" (1000
+// instances of a 1000 sphere cluster).
+inline bool named_scene(const std::string& name, scene_desc& scene) {
+    if (name == "final") scene = final_scene(0);
+    else if (name == "100k") scene = sphere_field(name, 100000, 100);
+    else if (name == "1m") scene = sphere_field(name, 1000000, 1000);
+    else if (name == "10m") scene = sphere_field(name, 10000000, 10000);
+    else if (name == "inst") scene = instanced_field(name, 1000, 1000, 1001);
+    else return false;
+    return true;
+}
+
+#endif
@@ -3,12 +3,13 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material.h"
 #include "vec3.h"
 
-class sphere : public hittable {
+class sphere final : public hittable {
 public:
     sphere(const point3& center, float radius, shared_ptr<material> mat)
-        : center(center), radius(std::fmax(0, radius)), mat(mat) {
+        : hittable(hittable_type::sphere), center(center), radius(std::fmax(0, radius)), mat(mat) {
     }
     //sphere(const point3& center, double radius) : center(center), radius(std::fmax(0, radius)) {}
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
@@ -34,7 +35,7 @@ public:
 
         rec.t = root;
         rec.p = r.at(rec.t);
-        rec.mat = mat;
+        rec.mat = mat.get();
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
 
@@ -54,13 +55,30 @@ public:
    const point3 getCenter()const override {
         return center;
     }
-   const float getRadius()const override {
+   float getRadius()const override {
         return radius;
     }
+   const shared_ptr<material>& getMaterial()const {
+        return mat;
+    }
+    uint64_t content_key() const override {
+        uint64_t key = mix_float(mix_float(mix_float(mix_float(0, center[0]), center[1]), center[2]), radius);
+        return mix64(key ^ material_key(*mat));
+    }
 private:
     point3 center;
     float radius;
     shared_ptr<material>mat;
 };
 
+// ͼԪֱӵãfinal ࣬ãѭͼԪ麯
+inline bool hit_object(const hittable& object, const ray& r, interval ray_t, hit_record& rec) {
+    switch (object.getType()) {
+    case hittable_type::sphere:
+        return static_cast<const sphere&>(object).hit(r, ray_t, rec);
+    default:
+        return object.hit(r, ray_t, rec);
+    }
+}
+
 #endif
@@ -0,0 +1,318 @@
+#pragma once
+#ifndef SPHERE_SOUP_H
+#define SPHERE_SOUP_H
+
+// Specialized primitive store for scenes made of spheres: centers, radii and
+// material ids live in contiguous SoA arrays, stored in the order of the BVH
+// leaves (soup index == position in LinearBVH::primIndices), so a leaf is a
+// contiguous range. A SIMD kernel tests a whole range without virtual calls
+// and only the nearest sphere gets a hit_record.
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "sphere.h"
+#include "quantizedBVH.h"
+#include "wideBVH.h"
+#include "raypacket.h"
+
+#if defined(__AVX__)
+struct soup_lanes {
+    static const int width = 8;
+    typedef __m256 f;
+    static f load(const float* p) { return _mm256_loadu_ps(p); }
+    static f set1(float v) { return _mm256_set1_ps(v); }
+    static f add(f a, f b) { return _mm256_add_ps(a, b); }
+    static f sub(f a, f b) { return _mm256_sub_ps(a, b); }
+    static f mul(f a, f b) { return _mm256_mul_ps(a, b); }
+    static f div(f a, f b) { return _mm256_div_ps(a, b); }
+    static f sqrt(f a) { return _mm256_sqrt_ps(a); }
+    static f max(f a, f b) { return _mm256_max_ps(a, b); }
+    static f gt(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static f lt(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static f ge(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static f and_(f a, f b) { return _mm256_and_ps(a, b); }
+    static f select(f mask, f a, f b) { return _mm256_blendv_ps(b, a, mask); }
+    static int movemask(f m) { return _mm256_movemask_ps(m); }
+    static void store(float* p, f a) { _mm256_storeu_ps(p, a); }
+};
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+struct soup_lanes {
+    static const int width = 4;
+    typedef __m128 f;
+    static f load(const float* p) { return _mm_loadu_ps(p); }
+    static f set1(float v) { return _mm_set1_ps(v); }
+    static f add(f a, f b) { return _mm_add_ps(a, b); }
+    static f sub(f a, f b) { return _mm_sub_ps(a, b); }
+    static f mul(f a, f b) { return _mm_mul_ps(a, b); }
+    static f div(f a, f b) { return _mm_div_ps(a, b); }
+    static f sqrt(f a) { return _mm_sqrt_ps(a); }
+    static f max(f a, f b) { return _mm_max_ps(a, b); }
+    static f gt(f a, f b) { return _mm_cmpgt_ps(a, b); }
+    static f lt(f a, f b) { return _mm_cmplt_ps(a, b); }
+    static f ge(f a, f b) { return _mm_cmpge_ps(a, b); }
+    static f and_(f a, f b) { return _mm_and_ps(a, b); }
+    static f select(f mask, f a, f b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    static int movemask(f m) { return _mm_movemask_ps(m); }
+    static void store(float* p, f a) { _mm_storeu_ps(p, a); }
+};
+#else
+struct soup_lanes {
+    static const int width = 1;
+    typedef float f;
+    static f load(const float* p) { return *p; }
+    static f set1(float v) { return v; }
+    static f add(f a, f b) { return a + b; }
+    static f sub(f a, f b) { return a - b; }
+    static f mul(f a, f b) { return a * b; }
+    static f div(f a, f b) { return a / b; }
+    static f sqrt(f a) { return std::sqrt(a); }
+    static f max(f a, f b) { return a > b ? a : b; }
+    static f gt(f a, f b) { return a > b ? 1.0f : 0.0f; }
+    static f lt(f a, f b) { return a < b ? 1.0f : 0.0f; }
+    static f ge(f a, f b) { return a >= b ? 1.0f : 0.0f; }
+    static f and_(f a, f b) { return (a != 0 && b != 0) ? 1.0f : 0.0f; }
+    static f select(f mask, f a, f b) { return mask != 0 ? a : b; }
+    static int movemask(f m) { return m != 0 ? 1 : 0; }
+    static void store(float* p, f a) { *p = a; }
+};
+#endif
+
+class sphere_soup {
+public:
+    // SoA arrays, padded by soup_lanes::width entries. They point into the
+    // storage below or into memory owned by someone else (a mapped scene file).
+    const float* cx = nullptr;
+    const float* cy = nullptr;
+    const float* cz = nullptr;
+    const float* radius = nullptr;
+    const uint32_t* materialId = nullptr;
+    // Soup position -> array entry, when the arrays are not in soup order. The
+    // kernel then gathers each block of lanes instead of loading it.
+    const int* index = nullptr;
+    std::vector<shared_ptr<material>> materials;    // Material table indexed by materialId
+    int count = 0;
+
+    sphere_soup() = default;
+    sphere_soup(sphere_soup&&) = default;               // Moving a vector keeps its buffer,
+    sphere_soup& operator=(sphere_soup&&) = default;    // so the views stay valid
+    sphere_soup(const sphere_soup&) = delete;
+    sphere_soup& operator=(const sphere_soup&) = delete;
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t MemoryBytes() const {
+        return floats.size() * sizeof(float) + ids.size() * sizeof(uint32_t);
+    }
+
+    // Views arrays of `n` spheres that outlive the soup. Every float array needs
+    // soup_lanes::width readable entries past the end unless `order` is given.
+    void View(const float* x, const float* y, const float* z, const float* r, const uint32_t* material, int n,
+        const int* order = nullptr) {
+        floats.clear();
+        ids.clear();
+        cx = x;
+        cy = y;
+        cz = z;
+        radius = r;
+        materialId = material;
+        index = order;
+        count = n;
+    }
+
+    // Nearest sphere in [begin, end) hit inside (tMin, tMax). Returns its index
+    // and shrinks tMax, or returns -1. Same arithmetic as sphere::hit.
+    int IntersectRange(const ray& r, int begin, int end, float tMin, float& tMax) const {
+        return index ? IntersectRange<true>(r, begin, end, tMin, tMax)
+            : IntersectRange<false>(r, begin, end, tMin, tMax);
+    }
+
+    void FillHitRecord(int i, const ray& r, float t, hit_record& rec) const {
+        int k = index ? index[i] : i;
+        point3 center(cx[k], cy[k], cz[k]);
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        rec.mat = materials[materialId[k]].get();
+        vec3 outward_normal = (rec.p - center) / radius[k];
+        rec.set_face_normal(r, outward_normal);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        float tMax = float(std::min(ray_t.max, double(std::numeric_limits<float>::max())));
+        int best = IntersectRange(r, 0, count, float(ray_t.min), tMax);
+        if (best < 0) return false;
+        FillHitRecord(best, r, tMax, rec);
+        return true;
+    }
+
+private:
+    friend bool BuildSphereSoup(const std::vector<shared_ptr<hittable>>&, const bvh_array<int>*, sphere_soup&);
+
+    std::vector<float> floats;      // cx, cy, cz and radius back to back when the soup owns its data
+    std::vector<uint32_t> ids;
+
+    template <bool Indexed>
+    int IntersectRange(const ray& r, int begin, int end, float tMin, float& tMax) const {
+        typedef soup_lanes L;
+        const vec3& o = r.origin();
+        const vec3& d = r.direction();
+        L::f ox = L::set1(o.x()), oy = L::set1(o.y()), oz = L::set1(o.z());
+        L::f dx = L::set1(d.x()), dy = L::set1(d.y()), dz = L::set1(d.z());
+        L::f a = L::set1(d.length_squared());
+        L::f zero = L::set1(0.0f);
+        L::f tmin = L::set1(tMin);
+
+        int best = -1;
+        float t[L::width];
+        float gx[L::width], gy[L::width], gz[L::width], gr[L::width];
+        for (int i = begin; i < end; i += L::width) {
+            L::f tmax = L::set1(tMax);
+            L::f ocx, ocy, ocz, rad;
+            if (Indexed) {
+                // Lanes past the end repeat the last sphere, the mask drops them
+                for (int lane = 0; lane < L::width; ++lane) {
+                    int k = index[std::min(i + lane, end - 1)];
+                    gx[lane] = cx[k];
+                    gy[lane] = cy[k];
+                    gz[lane] = cz[k];
+                    gr[lane] = radius[k];
+                }
+                ocx = L::sub(L::load(gx), ox);
+                ocy = L::sub(L::load(gy), oy);
+                ocz = L::sub(L::load(gz), oz);
+                rad = L::load(gr);
+            }
+            else {
+                ocx = L::sub(L::load(cx + i), ox);
+                ocy = L::sub(L::load(cy + i), oy);
+                ocz = L::sub(L::load(cz + i), oz);
+                rad = L::load(radius + i);
+            }
+            L::f h = L::add(L::add(L::mul(dx, ocx), L::mul(dy, ocy)), L::mul(dz, ocz));
+            L::f c = L::sub(L::add(L::add(L::mul(ocx, ocx), L::mul(ocy, ocy)), L::mul(ocz, ocz)), L::mul(rad, rad));
+            L::f disc = L::sub(L::mul(h, h), L::mul(a, c));
+            L::f sq = L::sqrt(L::max(disc, zero));
+            L::f near_root = L::div(L::sub(h, sq), a);
+            L::f far_root = L::div(L::add(h, sq), a);
+            L::f near_ok = L::and_(L::gt(near_root, tmin), L::lt(near_root, tmax));
+            L::f root = L::select(near_ok, near_root, far_root);
+            L::f ok = L::and_(L::ge(disc, zero), L::and_(L::gt(root, tmin), L::lt(root, tmax)));
+            int mask = L::movemask(ok);
+            if (end - i < L::width)
+                mask &= (1 << (end - i)) - 1;
+            if (!mask) continue;
+
+            // Resolve the candidates in index order, like the scalar loop would
+            L::store(t, root);
+            for (int lane = 0; lane < L::width; ++lane) {
+                if ((mask & (1 << lane)) && t[lane] < tMax) {
+                    tMax = t[lane];
+                    best = i + lane;
+                }
+            }
+        }
+        return best;
+    }
+};
+
+// Gathers the spheres in the given order (usually LinearBVH::primIndices, or
+// object order when order is null). Fails if any object is not a sphere.
+inline bool BuildSphereSoup(const std::vector<shared_ptr<hittable>>& objects, const bvh_array<int>* order,
+    sphere_soup& soup) {
+    int n = order ? int(order->size()) : int(objects.size());
+    size_t padded = size_t(n) + soup_lanes::width;
+    soup = sphere_soup();
+    soup.floats.assign(padded * 4, std::numeric_limits<float>::quiet_NaN());
+    soup.ids.assign(n, 0);
+    float* x = soup.floats.data();
+    float* y = x + padded;
+    float* z = y + padded;
+    float* r = z + padded;
+    std::fill(r, r + padded, 0.0f);
+
+    std::unordered_map<const material*, uint32_t> ids;
+    for (int i = 0; i < n; ++i) {
+        const sphere* s = dynamic_cast<const sphere*>(objects[order ? (*order)[i] : i].get());
+        if (!s) {
+            soup = sphere_soup();
+            return false;
+        }
+        point3 c = s->getCenter();
+        x[i] = c.x();
+        y[i] = c.y();
+        z[i] = c.z();
+        r[i] = s->getRadius();
+        auto found = ids.find(s->getMaterial().get());
+        if (found == ids.end()) {
+            found = ids.emplace(s->getMaterial().get(), uint32_t(soup.materials.size())).first;
+            soup.materials.push_back(s->getMaterial());
+        }
+        soup.ids[i] = found->second;
+    }
+    soup.cx = x;
+    soup.cy = y;
+    soup.cz = z;
+    soup.radius = r;
+    soup.materialId = soup.ids.data();
+    soup.count = n;
+    return true;
+}
+
+// Leaf callback for TraverseBVH / TraverseWideBVH on a soup in BVH leaf order.
+struct soup_leaf {
+    const sphere_soup& soup;
+    const ray& r;
+    float tMin;
+    int best = -1;
+
+    bool operator()(int offset, int count, float& tMax) {
+        int i = soup.IntersectRange(r, offset, offset + count, tMin, tMax);
+        if (i < 0) return false;
+        best = i;
+        return true;
+    }
+};
+
+inline bool BVHIntersect(const LinearBVH& bvh, const sphere_soup& soup, const ray& ray, hit_record& rec,
+    float tMin = 0.001f, float tMax = std::numeric_limits<float>::max()) {
+    soup_leaf leaf{ soup, ray, tMin };
+    if (!TraverseBVH(bvh, ray, tMax, leaf)) return false;
+    soup.FillHitRecord(leaf.best, ray, tMax, rec);
+    return true;
+}
+
+template <int N>
+bool WideBVHIntersect(const WideBVH<N>& bvh, const sphere_soup& soup, const ray& ray, hit_record& rec,
+    float tMin = 0.001f, float tMax = std::numeric_limits<float>::max()) {
+    soup_leaf leaf{ soup, ray, tMin };
+    if (!TraverseWideBVH(bvh, ray, tMax, leaf)) return false;
+    soup.FillHitRecord(leaf.best, ray, tMax, rec);
+    return true;
+}
+
+// The soup has to be in the quantized tree's own leaf order.
+template <int N>
+bool QuantizedBVHIntersect(const QuantizedBVH<N>& bvh, const sphere_soup& soup, const ray& ray, hit_record& rec,
+    float tMin = 0.001f, float tMax = std::numeric_limits<float>::max()) {
+    soup_leaf leaf{ soup, ray, tMin };
+    if (!TraverseQuantizedBVH(bvh, ray, tMax, leaf)) return false;
+    soup.FillHitRecord(leaf.best, ray, tMax, rec);
+    return true;
+}
+
+inline int IntersectPacket(const LinearBVH& bvh, const sphere_soup& soup, ray_packet& packet, hit_record* recs,
+    float tMin = 0.001f) {
+    int best[RAY_PACKET_SIZE];
+    int hits = TraversePacket(bvh, packet, [&](int lane, int offset, int count, float& tMax) {
+        int i = soup.IntersectRange(packet.rays[lane], offset, offset + count, tMin, tMax);
+        if (i < 0) return false;
+        best[lane] = i;
+        return true;
+    });
+    for (int lane = 0; lane < packet.count; ++lane)
+        if (hits & (1 << lane))
+            soup.FillHitRecord(best[lane], packet.rays[lane], packet.tMax[lane], recs[lane]);
+    return hits;
+}
+
+#endif
@@ -0,0 +1,171 @@
+#pragma once
+#ifndef STATS_H
+#define STATS_H
+
+// Optional render statistics. Build with RT_STATS defined (-DRT_STATS, or in the
+// project's preprocessor definitions) to enable them; otherwise every STAT_*
+// macro expands to nothing and the hot paths are exactly what they were.
+//
+// Each thread counts into its own render_counters without synchronization. The
+// counters of live threads and of threads that already exited are merged only
+// when a report is collected.
+
+#include <cstdint>
+
+#ifdef RT_STATS
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+const int STATS_PATH_BUCKETS = 65;  // Path lengths 0 .. 63, the last bucket holds 64 and more
+const int STATS_MATERIAL_TYPES = 4; // material_type_count, checked in camera.h
+
+struct render_counters {
+    uint64_t traversals = 0;       // Closest-hit queries against an acceleration structure
+    uint64_t boxTests = 0;         // Slab tests, one per child box for the wide trees
+    uint64_t nodesVisited = 0;     // Nodes whose box the ray entered
+    uint64_t leavesVisited = 0;
+    uint64_t primitiveTests = 0;
+    uint64_t leafHits = 0;         // Leaves that shortened the ray
+    uint64_t paths = 0;
+    uint64_t pathLength[STATS_PATH_BUCKETS] = {};
+    uint64_t escaped = 0;          // Paths that left the scene
+    uint64_t absorbed = 0;         // scatter() refused or the throughput reached zero
+    uint64_t rouletteKilled = 0;
+    uint64_t maxDepthReached = 0;
+    uint64_t materialHits[STATS_MATERIAL_TYPES] = {};
+
+    void merge(const render_counters& o) {
+        traversals += o.traversals;
+        boxTests += o.boxTests;
+        nodesVisited += o.nodesVisited;
+        leavesVisited += o.leavesVisited;
+        primitiveTests += o.primitiveTests;
+        leafHits += o.leafHits;
+        paths += o.paths;
+        for (int i = 0; i < STATS_PATH_BUCKETS; ++i)
+            pathLength[i] += o.pathLength[i];
+        escaped += o.escaped;
+        absorbed += o.absorbed;
+        rouletteKilled += o.rouletteKilled;
+        maxDepthReached += o.maxDepthReached;
+        for (int i = 0; i < STATS_MATERIAL_TYPES; ++i)
+            materialHits[i] += o.materialHits[i];
+    }
+
+    void addPath(int length) {
+        ++paths;
+        ++pathLength[std::min(std::max(length, 0), STATS_PATH_BUCKETS - 1)];
+    }
+
+    // Work of one traversal in one number, used for the heatmap.
+    uint64_t cost() const { return boxTests + primitiveTests; }
+};
+
+class stats_registry {
+public:
+    void add(render_counters* c) {
+        std::lock_guard<std::mutex> lock(mutex);
+        live.push_back(c);
+    }
+    void retire(render_counters* c) {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.merge(*c);
+        live.erase(std::find(live.begin(), live.end(), c));
+    }
+    render_counters collect() {
+        std::lock_guard<std::mutex> lock(mutex);
+        render_counters total = retired;
+        for (const render_counters* c : live)
+            total.merge(*c);
+        return total;
+    }
+    // Only meaningful while no thread is counting.
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired = render_counters();
+        for (render_counters* c : live)
+            *c = render_counters();
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<render_counters*> live;
+    render_counters retired;
+};
+
+inline stats_registry& stats_counters() {
+    static stats_registry registry;
+    return registry;
+}
+
+inline render_counters& thread_stats() {
+    struct holder {
+        render_counters counters;
+        holder() { stats_counters().add(&counters); }
+        ~holder() { stats_counters().retire(&counters); }
+    };
+    thread_local holder h;
+    return h.counters;
+}
+
+// Adds the traversal cost spent while it is alive to `target`.
+struct stats_cost_scope {
+    uint64_t& target;
+    uint64_t start;
+    explicit stats_cost_scope(uint64_t& target) : target(target), start(thread_stats().cost()) {}
+    ~stats_cost_scope() { target += thread_stats().cost() - start; }
+};
+
+inline void print_stats_report(std::ostream& out, const render_counters& s) {
+    double rays = double(std::max<uint64_t>(s.traversals, 1));
+    out << "---- Render statistics ----\n"
+        << "Traversals:            " << s.traversals << "\n"
+        << "Box tests / ray:       " << s.boxTests / rays << "\n"
+        << "Nodes visited / ray:   " << s.nodesVisited / rays << "\n"
+        << "Leaves visited / ray:  " << s.leavesVisited / rays << "\n"
+        << "Prim tests / ray:      " << s.primitiveTests / rays << "\n"
+        << "Prim tests / leaf:     " << double(s.primitiveTests) / std::max<uint64_t>(s.leavesVisited, 1) << "\n"
+        << "Leaf hit rate:         " << 100.0 * s.leafHits / std::max<uint64_t>(s.leavesVisited, 1) << " %\n";
+
+    double paths = double(std::max<uint64_t>(s.paths, 1));
+    double meanLength = 0;
+    for (int i = 0; i < STATS_PATH_BUCKETS; ++i)
+        meanLength += double(i) * s.pathLength[i];
+    out << "Paths:                 " << s.paths << ", mean length " << meanLength / paths << "\n"
+        << "  escaped " << 100.0 * s.escaped / paths << " %, absorbed " << 100.0 * s.absorbed / paths
+        << " %, roulette " << 100.0 * s.rouletteKilled / paths << " %, max depth "
+        << 100.0 * s.maxDepthReached / paths << " %\n"
+        << "Path length histogram:\n";
+    int last = 0;
+    for (int i = 0; i < STATS_PATH_BUCKETS; ++i)
+        if (s.pathLength[i]) last = i;
+    for (int i = 0; i <= last; ++i) {
+        out << "  " << (i == STATS_PATH_BUCKETS - 1 ? "64+" : std::to_string(i)) << ": " << s.pathLength[i]
+            << " (" << 100.0 * s.pathLength[i] / paths << " %)\n";
+    }
+    const char* names[STATS_MATERIAL_TYPES] = { "lambertian", "metal", "dielectric", "other" };
+    out << "Hits per material:    ";
+    for (int i = 0; i < STATS_MATERIAL_TYPES; ++i)
+        out << " " << names[i] << " " << s.materialHits[i];
+    out << "\n";
+}
+
+#define STAT_INC(field) (++thread_stats().field)
+#define STAT_ADD(field, n) (thread_stats().field += uint64_t(n))
+#define STAT_PATH(length) thread_stats().addPath(length)
+#define STAT_COST_SCOPE(target) stats_cost_scope stat_cost_scope_guard(target)
+
+#else
+
+#define STAT_INC(field) ((void)0)
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_PATH(length) ((void)0)
+#define STAT_COST_SCOPE(target) ((void)0)
+
+#endif
+
+#endif
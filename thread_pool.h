@@ -0,0 +1,165 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops its
+// own tasks at the back (LIFO, cache friendly for nested work) and steals from
+// the front of the other deques when it runs dry.
+class thread_pool {
+public:
+    explicit thread_pool(int thread_count = 0) {
+        if (thread_count <= 0)
+            thread_count = std::max(1, int(std::thread::hardware_concurrency()));
+        for (int i = 0; i < thread_count; ++i)
+            queues.push_back(std::make_unique<worker_queue>());
+        for (int i = 0; i < thread_count; ++i)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return int(workers.size()); }
+
+    // Tasks submitted from a worker go to its own deque, others are spread round robin.
+    void submit(std::function<void()> task) {
+        int self = current_worker();
+        int target = self >= 0 ? self : int(next_queue++ % queues.size());
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            ++queued;
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until `pending` reaches zero. The calling thread keeps executing
+    // queued tasks meanwhile, so waiting inside a task never deadlocks the pool.
+    void wait(const std::atomic<int>& pending) {
+        std::function<void()> task;
+        while (pending.load(std::memory_order_acquire) > 0) {
+            if (pop_task(current_worker(), task)) {
+                task();
+                task = nullptr;
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Runs f(0) .. f(count - 1) as separate tasks and returns once all are done.
+    template <class F>
+    void parallel_for(int count, F&& f) {
+        std::atomic<int> pending(count);
+        for (int i = 0; i < count; ++i) {
+            submit([&f, &pending, i] {
+                f(i);
+                pending.fetch_sub(1, std::memory_order_release);
+            });
+        }
+        wait(pending);
+    }
+
+private:
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    int queued = 0;  // Guarded by sleep_mutex
+    bool stopping = false;
+    std::atomic<unsigned int> next_queue{ 0 };
+
+    // Index of the calling thread inside this pool, -1 for outside threads.
+    int current_worker() const {
+        return worker_owner() == this ? worker_id() : -1;
+    }
+    static const thread_pool*& worker_owner() {
+        thread_local const thread_pool* owner = nullptr;
+        return owner;
+    }
+    static int& worker_id() {
+        thread_local int id = -1;
+        return id;
+    }
+
+    bool pop_task(int self, std::function<void()>& task) {
+        int n = int(queues.size());
+        if (self >= 0) {
+            std::lock_guard<std::mutex> lock(queues[self]->mutex);
+            auto& own = queues[self]->tasks;
+            if (!own.empty()) {
+                task = std::move(own.back());
+                own.pop_back();
+                return took_task();
+            }
+        }
+        int first = self >= 0 ? self + 1 : 0;
+        for (int k = 0; k < n; ++k) {
+            int victim = (first + k) % n;
+            if (victim == self)
+                continue;
+            std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+            auto& other = queues[victim]->tasks;
+            if (!other.empty()) {
+                task = std::move(other.front());
+                other.pop_front();
+                return took_task();
+            }
+        }
+        return false;
+    }
+
+    bool took_task() {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        --queued;
+        return true;
+    }
+
+    void worker_loop(int index) {
+        worker_owner() = this;
+        worker_id() = index;
+        std::function<void()> task;
+        while (true) {
+            if (pop_task(index, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#pragma once
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+// Affine transform as a 3x4 matrix: p' = M p + t. Used by instances to move
+// rays into object space and hits back into the world.
+
+#include <cmath>
+#include "rtweekend.h"
+
+struct transform {
+    float m[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+
+    static transform translate(const vec3& offset) {
+        transform t;
+        for (int i = 0; i < 3; ++i)
+            t.m[i][3] = offset[i];
+        return t;
+    }
+    static transform scale(float s) {
+        transform t;
+        for (int i = 0; i < 3; ++i)
+            t.m[i][i] = s;
+        return t;
+    }
+    // Counter-clockwise around +y when looking down from above, in degrees.
+    static transform rotate_y(float degrees) {
+        float radians = float(degrees_to_radians(degrees));
+        float c = std::cos(radians), s = std::sin(radians);
+        transform t;
+        t.m[0][0] = c;
+        t.m[0][2] = s;
+        t.m[2][0] = -s;
+        t.m[2][2] = c;
+        return t;
+    }
+
+    point3 point(const point3& p) const {
+        return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+            m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+            m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+            m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+            m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+    // Normals go through the transposed inverse; call this on the inverse.
+    vec3 normal(const vec3& n) const {
+        return vec3(m[0][0] * n[0] + m[1][0] * n[1] + m[2][0] * n[2],
+            m[0][1] * n[0] + m[1][1] * n[1] + m[2][1] * n[2],
+            m[0][2] * n[0] + m[1][2] * n[1] + m[2][2] * n[2]);
+    }
+
+    // Box around the eight transformed corners.
+    Bounds3 bounds(const Bounds3& b) const {
+        Bounds3 result;
+        for (int corner = 0; corner < 8; ++corner) {
+            point3 p((corner & 1) ? b.pMax[0] : b.pMin[0], (corner & 2) ? b.pMax[1] : b.pMin[1],
+                (corner & 4) ? b.pMax[2] : b.pMin[2]);
+            p = point(p);
+            result = Bounds3(Min(result.pMin, p), Max(result.pMax, p));
+        }
+        return result;
+    }
+
+    // This transform applied after `first`.
+    transform operator*(const transform& first) const {
+        transform t;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                t.m[i][j] = m[i][0] * first.m[0][j] + m[i][1] * first.m[1][j] + m[i][2] * first.m[2][j]
+                    + (j == 3 ? m[i][3] : 0.0f);
+            }
+        }
+        return t;
+    }
+
+    // Affine inverse; the matrix part must not be singular.
+    transform inverse() const {
+        const float (*a)[4] = m;
+        float det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+            - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+            + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+        float inv = 1.0f / det;
+        transform t;
+        t.m[0][0] = (a[1][1] * a[2][2] - a[1][2] * a[2][1]) * inv;
+        t.m[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * inv;
+        t.m[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * inv;
+        t.m[1][0] = (a[1][2] * a[2][0] - a[1][0] * a[2][2]) * inv;
+        t.m[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * inv;
+        t.m[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * inv;
+        t.m[2][0] = (a[1][0] * a[2][1] - a[1][1] * a[2][0]) * inv;
+        t.m[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * inv;
+        t.m[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * inv;
+        vec3 offset = t.vector(vec3(a[0][3], a[1][3], a[2][3]));
+        for (int i = 0; i < 3; ++i)
+            t.m[i][3] = -offset[i];
+        return t;
+    }
+};
+
+#endif
@@ -0,0 +1,175 @@
+#pragma once
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+// Indexed triangle mesh: one hittable for the whole mesh, with a shared vertex
+// buffer, three uint32 indices per triangle and a BVH of its own over triangle
+// references. After the build the triangles are reordered into BVH leaf order,
+// so a leaf is a contiguous range of the index buffer and no primIndices array
+// is kept.
+//
+// The ray-triangle test is the watertight one of Woop, Benthin and Wald
+// ("Watertight Ray/Triangle Intersection", JCGT 2013): rays through a shared
+// edge or vertex never slip between the triangles.
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "rtweekend.h"
+#include "hittable.h"
+#include "material.h"
+#include "thread_pool.h"
+
+// Per ray part of the watertight test: the axis the ray runs along most is
+// made z and the ray is sheared onto the +z axis.
+struct watertight_ray {
+    point3 origin;
+    int kx, ky, kz;
+    float Sx, Sy, Sz;
+
+    explicit watertight_ray(const ray& r) : origin(r.origin()) {
+        const vec3& d = r.direction();
+        vec3 a(std::fabs(d.x()), std::fabs(d.y()), std::fabs(d.z()));
+        kz = a.x() > a.y() ? (a.x() > a.z() ? 0 : 2) : (a.y() > a.z() ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        if (d[kz] < 0) std::swap(kx, ky);  // Keeps the winding of the triangles
+        Sx = d[kx] / d[kz];
+        Sy = d[ky] / d[kz];
+        Sz = 1.0f / d[kz];
+    }
+
+    // Ray parameter of the hit inside (tMin, tMax), or false.
+    bool intersect(const point3& p0, const point3& p1, const point3& p2, float tMin, float tMax, float& t) const {
+        vec3 A = p0 - origin, B = p1 - origin, C = p2 - origin;
+        float Ax = A[kx] - Sx * A[kz], Ay = A[ky] - Sy * A[kz];
+        float Bx = B[kx] - Sx * B[kz], By = B[ky] - Sy * B[kz];
+        float Cx = C[kx] - Sx * C[kz], Cy = C[ky] - Sy * C[kz];
+
+        // Scaled barycentrics: edge functions of the projected triangle. The
+        // products of two floats are exact in double, so each difference is
+        // rounded once and a shared edge gets exactly opposite values in both
+        // triangles, even where the compiler contracts to FMA. The paper only
+        // falls back to double when a float result is zero; always using it
+        // also keeps float FMA contraction from breaking the edge.
+        double U = double(Cx) * By - double(Cy) * Bx;
+        double V = double(Ax) * Cy - double(Ay) * Cx;
+        double W = double(Bx) * Ay - double(By) * Ax;
+        if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0))
+            return false;
+        double det = U + V + W;
+        if (det == 0.0)
+            return false;
+
+        double T = U * (Sz * A[kz]) + V * (Sz * B[kz]) + W * (Sz * C[kz]);
+        t = float(T / det);
+        return t > tMin && t < tMax;
+    }
+};
+
+class triangle_mesh final : public hittable {
+public:
+    // indices holds three vertex indices per triangle, all of them < vertices.size().
+    triangle_mesh(std::vector<point3> vertices, std::vector<uint32_t> indices, shared_ptr<material> mat,
+        thread_pool* pool = nullptr)
+        : vertices(std::move(vertices)), indices(std::move(indices)), mat(std::move(mat)) {
+        build(pool);
+        key = hashContent();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        watertight_ray wr(r);
+        float tMin = float(ray_t.min);
+        float tMax = float(std::min(ray_t.max, double(std::numeric_limits<float>::max())));
+        int best = -1;
+        TraverseBVH(bvh, r, tMax, [&](int offset, int count, float& tMax) {
+            bool hitAny = false;
+            for (int i = offset; i < offset + count; ++i) {
+                float t;
+                if (wr.intersect(vertex(i, 0), vertex(i, 1), vertex(i, 2), tMin, tMax, t)) {
+                    tMax = t;
+                    best = i;
+                    hitAny = true;
+                }
+            }
+            return hitAny;
+        });
+        if (best < 0)
+            return false;
+
+        rec.t = tMax;
+        rec.p = r.at(rec.t);
+        rec.mat = mat.get();
+        vec3 outward_normal = unit_vector(cross(vertex(best, 1) - vertex(best, 0), vertex(best, 2) - vertex(best, 0)));
+        rec.set_face_normal(r, outward_normal);
+        return true;
+    }
+
+    Bounds3 bounding_box() const override { return box; }
+    inline point3 getMaxCornerPoint() const override { return box.pMax; }
+    inline point3 getMinCornerPoint() const override { return box.pMin; }
+    const point3 getCenter() const override { return box.Centroid(); }
+    float getRadius() const override { return 0.5f * (box.pMax - box.pMin).length(); }
+    uint64_t content_key() const override { return key; }
+
+    int triangleCount() const { return int(indices.size() / 3); }
+    int vertexCount() const { return int(vertices.size()); }
+    const LinearBVH& getBVH() const { return bvh; }
+    size_t MemoryBytes() const {
+        return vertices.size() * sizeof(point3) + indices.size() * sizeof(uint32_t) + bvh.MemoryBytes();
+    }
+
+private:
+    std::vector<point3> vertices;
+    std::vector<uint32_t> indices;  // In BVH leaf order after build()
+    shared_ptr<material> mat;
+    LinearBVH bvh;
+    Bounds3 box;
+    uint64_t key = 0;  // content_key(), hashed once: the mesh does not change after construction
+
+    const point3& vertex(int triangle, int corner) const { return vertices[indices[3 * size_t(triangle) + corner]]; }
+
+    // The SAH counts leaf triangles in blocks of four (leafWidth): a leaf of up
+    // to four costs one fetch of the index buffer, and the tree needs less than
+    // half the nodes of one triangle per leaf at the same ray throughput.
+    void build(thread_pool* pool) {
+        int n = triangleCount();
+        auto bounds = [this](int i) {
+            const point3& a = vertex(i, 0);
+            const point3& b = vertex(i, 1);
+            const point3& c = vertex(i, 2);
+            return Bounds3(Min(a, Min(b, c)), Max(a, Max(b, c)));
+        };
+        bvh = BuildLinearBVHFromBounds(n, bounds, 4, SplitMethod::SAH, pool, 4);
+        if (bvh.empty())
+            return;
+        // The oversized triangles are outside the tree, so the root box misses them
+        box = bvh.nodes[0].bounds;
+        for (int i = bvh.oversizedOffset; i < bvh.oversizedOffset + bvh.oversizedCount; ++i)
+            box = uni(box, bounds(bvh.primIndices[i]));
+
+        // Triangle references -> triangles in leaf order, the references are dropped
+        std::vector<uint32_t> ordered(indices.size());
+        for (int i = 0; i < n; ++i) {
+            const uint32_t* src = &indices[3 * size_t(bvh.primIndices[i])];
+            ordered[3 * size_t(i)] = src[0];
+            ordered[3 * size_t(i) + 1] = src[1];
+            ordered[3 * size_t(i) + 2] = src[2];
+        }
+        indices.swap(ordered);
+        bvh.primIndices = bvh_array<int>();
+    }
+
+    // Every vertex, the triangles in leaf order and the material
+    uint64_t hashContent() const {
+        uint64_t h = mix64(vertices.size() ^ (uint64_t(indices.size()) << 32));
+        for (const point3& v : vertices)
+            h = mix_float(mix_float(mix_float(h, v[0]), v[1]), v[2]);
+        for (uint32_t i : indices)
+            h = mix64(h ^ i);
+        return mix64(h ^ material_key(*mat));
+    }
+};
+
+#endif
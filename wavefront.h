@@ -0,0 +1,71 @@
+#pragma once
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <vector>
+#include "material.h"
+
+// Structure-of-arrays storage for one wave of in-flight paths. The camera
+// intersects every active path, groups the hits by material type and then
+// shades one material type at a time before starting the next bounce.
+struct path_batch {
+    std::vector<float> ox, oy, oz;  // Current ray origins
+    std::vector<float> dx, dy, dz;  // Current ray directions
+    std::vector<float> tr, tg, tb;  // Path throughput
+    std::vector<float> lr, lg, lb;  // Radiance of the finished path
+    std::vector<uint32_t> pixel;    // Pixel index of the path
+    std::vector<uint32_t> sample;   // Sample index inside the pixel
+    std::vector<hit_record> hits;   // Intersection of the current bounce
+
+    std::vector<int> active;        // Paths still traced at this bounce
+    std::vector<int> shading;       // Paths that hit something, grouped by material type
+    int bin_start[material_type_count + 1] = {};  // Range of each material type in shading
+
+    int size() const { return int(pixel.size()); }
+
+    void resize(int n) {
+        for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz, &tr, &tg, &tb, &lr, &lg, &lb })
+            v->resize(n);
+        pixel.resize(n);
+        sample.resize(n);
+        hits.resize(n);
+        active.reserve(n);
+        shading.resize(n);
+    }
+
+    ray get_ray(int i) const {
+        return ray(point3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]));
+    }
+
+    void set_ray(int i, const ray& r) {
+        ox[i] = r.origin().x(); oy[i] = r.origin().y(); oz[i] = r.origin().z();
+        dx[i] = r.direction().x(); dy[i] = r.direction().y(); dz[i] = r.direction().z();
+    }
+
+    color throughput(int i) const { return color(tr[i], tg[i], tb[i]); }
+
+    void set_throughput(int i, const color& c) {
+        tr[i] = c.x(); tg[i] = c.y(); tb[i] = c.z();
+    }
+
+    void finish(int i, const color& c) {
+        lr[i] = c.x(); lg[i] = c.y(); lb[i] = c.z();
+    }
+
+    // Counting sort of the paths that hit a surface by the type of the hit material.
+    void sort_by_material(const std::vector<int>& hit_paths) {
+        int counts[material_type_count] = {};
+        for (int i : hit_paths)
+            ++counts[int(hits[i].mat->kind)];
+        bin_start[0] = 0;
+        for (int k = 0; k < material_type_count; ++k)
+            bin_start[k + 1] = bin_start[k] + counts[k];
+        int cursor[material_type_count];
+        for (int k = 0; k < material_type_count; ++k)
+            cursor[k] = bin_start[k];
+        for (int i : hit_paths)
+            shading[cursor[int(hits[i].mat->kind)]++] = i;
+    }
+};
+
+#endif
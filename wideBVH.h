@@ -0,0 +1,290 @@
+#pragma once
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+// N-wide BVH collapsed from the binary LinearBVH. Each node stores the boxes
+// of its up to N children in SoA form so a ray is tested against all of them
+// with one SIMD sequence, and the hit children are visited nearest first.
+
+#include <vector>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+template <int N>
+struct alignas(32) WideBVHNode {
+    float minX[N], minY[N], minZ[N];
+    float maxX[N], maxY[N], maxZ[N];
+    int32_t child[N];   // Interior child: node index; leaf child: offset into primIndices; empty: -1
+    uint16_t count[N];  // Primitive count of a leaf child, 0 for interior or empty children
+
+    WideBVHNode() {
+        for (int i = 0; i < N; ++i) {
+            // Empty slots get an inverted box that no ray can enter.
+            minX[i] = minY[i] = minZ[i] = std::numeric_limits<float>::infinity();
+            maxX[i] = maxY[i] = maxZ[i] = -std::numeric_limits<float>::infinity();
+            child[i] = -1;
+            count[i] = 0;
+        }
+    }
+
+    void SetBounds(int i, const Bounds3& b) {
+        minX[i] = b.pMin[0]; minY[i] = b.pMin[1]; minZ[i] = b.pMin[2];
+        maxX[i] = b.pMax[0]; maxY[i] = b.pMax[1]; maxZ[i] = b.pMax[2];
+    }
+};
+
+template <int N>
+struct WideBVH {
+    std::vector<WideBVHNode<N>> nodes;
+    const LinearBVH* binary = nullptr;  // Source tree, owns primIndices and the object list
+
+    bool empty() const { return nodes.empty(); }
+    size_t MemoryBytes() const { return nodes.size() * sizeof(WideBVHNode<N>); }
+};
+
+typedef WideBVH<4> WideBVH4;
+typedef WideBVH<8> WideBVH8;
+
+// Opens the interior child with the largest surface area until the node has N
+// children, so the binary levels in between disappear. Writes the binary node
+// indices of the children to kids and returns their number.
+template <int N>
+int CollapseChildren(const LinearBVH& binary, int binIndex, int kids[N]) {
+    int k = 0;
+    const LinearBVHNode& root = binary.nodes[binIndex];
+    if (root.nPrimitives > 0) {
+        kids[k++] = binIndex;
+    }
+    else {
+        kids[k++] = binIndex + 1;
+        kids[k++] = root.secondChildOffset;
+    }
+    while (k < N) {
+        int best = -1;
+        float bestArea = -1;
+        for (int i = 0; i < k; ++i) {
+            const LinearBVHNode& c = binary.nodes[kids[i]];
+            if (c.nPrimitives == 0 && c.bounds.SurfaceArea() > bestArea) {
+                bestArea = c.bounds.SurfaceArea();
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        int opened = kids[best];
+        kids[best] = opened + 1;
+        kids[k++] = binary.nodes[opened].secondChildOffset;
+    }
+    return k;
+}
+
+template <int N>
+int CollapseBVHNode(const LinearBVH& binary, int binIndex, WideBVH<N>& wide) {
+    int index = int(wide.nodes.size());
+    wide.nodes.emplace_back();
+
+    int kids[N];
+    int k = CollapseChildren<N>(binary, binIndex, kids);
+    for (int i = 0; i < k; ++i) {
+        const LinearBVHNode& c = binary.nodes[kids[i]];
+        int child;
+        if (c.nPrimitives > 0) {
+            child = c.primitivesOffset;
+        }
+        else {
+            child = CollapseBVHNode(binary, kids[i], wide);
+        }
+        // nodes may have grown during the recursion, index again
+        WideBVHNode<N>& node = wide.nodes[index];
+        node.SetBounds(i, c.bounds);
+        node.child[i] = child;
+        node.count[i] = c.nPrimitives;
+    }
+    return index;
+}
+
+template <int N>
+WideBVH<N> CollapseBVH(const LinearBVH& binary) {
+    WideBVH<N> wide;
+    wide.binary = &binary;
+    if (!binary.empty()) {
+        wide.nodes.reserve(binary.nodes.size() / (N - 1) + 1);
+        CollapseBVHNode(binary, 0, wide);
+    }
+    return wide;
+}
+
+// Slab test of one ray against the N children of a node. The near/far planes
+// are picked per axis from the ray direction signs, so no min/max swaps are
+// needed. Returns a bit mask of hit children and their entry distances.
+template <int N>
+inline int IntersectChildren(const WideBVHNode<N>& node, const float o[3], const float inv[3],
+    const int dirIsNeg[3], float tMax, float tNear[N]) {
+    const float* nearX = dirIsNeg[0] ? node.maxX : node.minX;
+    const float* farX = dirIsNeg[0] ? node.minX : node.maxX;
+    const float* nearY = dirIsNeg[1] ? node.maxY : node.minY;
+    const float* farY = dirIsNeg[1] ? node.minY : node.maxY;
+    const float* nearZ = dirIsNeg[2] ? node.maxZ : node.minZ;
+    const float* farZ = dirIsNeg[2] ? node.minZ : node.maxZ;
+    int mask = 0;
+    for (int i = 0; i < N; ++i) {
+        float t0 = std::max(std::max((nearX[i] - o[0]) * inv[0], (nearY[i] - o[1]) * inv[1]),
+            std::max((nearZ[i] - o[2]) * inv[2], 0.0f));
+        float t1 = std::min(std::min(std::min((farX[i] - o[0]) * inv[0], (farY[i] - o[1]) * inv[1]),
+            (farZ[i] - o[2]) * inv[2]) * BOX_EXIT_SCALE, tMax);
+        tNear[i] = t0;
+        if (t0 <= t1) mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+template <>
+inline int IntersectChildren<4>(const WideBVHNode<4>& node, const float o[3], const float inv[3],
+    const int dirIsNeg[3], float tMax, float tNear[4]) {
+    __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dirIsNeg[0] ? node.maxX : node.minX), _mm_set1_ps(o[0])), _mm_set1_ps(inv[0]));
+    __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dirIsNeg[0] ? node.minX : node.maxX), _mm_set1_ps(o[0])), _mm_set1_ps(inv[0]));
+    __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dirIsNeg[1] ? node.maxY : node.minY), _mm_set1_ps(o[1])), _mm_set1_ps(inv[1]));
+    __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dirIsNeg[1] ? node.minY : node.maxY), _mm_set1_ps(o[1])), _mm_set1_ps(inv[1]));
+    __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dirIsNeg[2] ? node.maxZ : node.minZ), _mm_set1_ps(o[2])), _mm_set1_ps(inv[2]));
+    __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dirIsNeg[2] ? node.minZ : node.maxZ), _mm_set1_ps(o[2])), _mm_set1_ps(inv[2]));
+    __m128 t0 = _mm_max_ps(_mm_max_ps(t0x, t0y), _mm_max_ps(t0z, _mm_setzero_ps()));
+    __m128 t1 = _mm_min_ps(_mm_mul_ps(_mm_min_ps(_mm_min_ps(t1x, t1y), t1z), _mm_set1_ps(BOX_EXIT_SCALE)),
+        _mm_set1_ps(tMax));
+    _mm_storeu_ps(tNear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline int IntersectChildren<8>(const WideBVHNode<8>& node, const float o[3], const float inv[3],
+    const int dirIsNeg[3], float tMax, float tNear[8]) {
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dirIsNeg[0] ? node.maxX : node.minX), _mm256_set1_ps(o[0])), _mm256_set1_ps(inv[0]));
+    __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dirIsNeg[0] ? node.minX : node.maxX), _mm256_set1_ps(o[0])), _mm256_set1_ps(inv[0]));
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dirIsNeg[1] ? node.maxY : node.minY), _mm256_set1_ps(o[1])), _mm256_set1_ps(inv[1]));
+    __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dirIsNeg[1] ? node.minY : node.maxY), _mm256_set1_ps(o[1])), _mm256_set1_ps(inv[1]));
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dirIsNeg[2] ? node.maxZ : node.minZ), _mm256_set1_ps(o[2])), _mm256_set1_ps(inv[2]));
+    __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dirIsNeg[2] ? node.minZ : node.maxZ), _mm256_set1_ps(o[2])), _mm256_set1_ps(inv[2]));
+    __m256 t0 = _mm256_max_ps(_mm256_max_ps(t0x, t0y), _mm256_max_ps(t0z, _mm256_setzero_ps()));
+    __m256 t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_min_ps(_mm256_min_ps(t1x, t1y), t1z),
+        _mm256_set1_ps(BOX_EXIT_SCALE)), _mm256_set1_ps(tMax));
+    _mm256_storeu_ps(tNear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+inline int LowestBit(unsigned int mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Same contract as TraverseBVH: leaf(offset, count, tMax) tests a leaf range of
+// primIndices and shrinks tMax on a hit.
+template <int N, class LeafFn>
+bool TraverseWideBVH(const WideBVH<N>& bvh, const ray& ray, float& tMax, LeafFn&& leaf) {
+    if (bvh.empty()) return false;
+
+    float o[3] = { ray.origin()[0], ray.origin()[1], ray.origin()[2] };
+    float inv[3] = { 1.0f / ray.direction()[0], 1.0f / ray.direction()[1], 1.0f / ray.direction()[2] };
+    int dirIsNeg[3] = { inv[0] < 0, inv[1] < 0, inv[2] < 0 };
+
+    struct Entry {
+        int child;  // Node index, or primIndices offset for leaves
+        int count;  // > 0 for leaves
+        float t;    // Entry distance, lets stale entries be skipped once tMax shrinks
+    };
+    Entry stack[64 * N];
+    int sp = 0;
+    Entry current = { 0, 0, 0.0f };
+    bool hitAny = false;
+    STAT_INC(traversals);
+    // Oversized primitives kept out of the tree, tested once up front
+    const LinearBVH& binary = *bvh.binary;
+    if (binary.oversizedCount > 0) {
+        STAT_ADD(primitiveTests, binary.oversizedCount);
+        hitAny = leaf(binary.oversizedOffset, binary.oversizedCount, tMax);
+    }
+
+    while (true) {
+        if (current.count > 0) {
+            STAT_INC(leavesVisited);
+            STAT_ADD(primitiveTests, current.count);
+            if (leaf(current.child, current.count, tMax)) {
+                STAT_INC(leafHits);
+                hitAny = true;
+            }
+        }
+        else {
+            const WideBVHNode<N>& node = bvh.nodes[current.child];
+            alignas(32) float tNear[N];
+            STAT_INC(nodesVisited);
+            STAT_ADD(boxTests, N);
+            unsigned int mask = IntersectChildren<N>(node, o, inv, dirIsNeg, tMax, tNear);
+            if (mask) {
+                int first = LowestBit(mask);
+                mask &= mask - 1;
+                if (!mask) {
+                    // Only one child hit: descend without touching the stack
+                    current = { node.child[first], node.count[first], tNear[first] };
+                    continue;
+                }
+                // Several children hit: sort them far to near, push all but the
+                // nearest and continue with the nearest one directly.
+                Entry hits[N];
+                hits[0] = { node.child[first], node.count[first], tNear[first] };
+                int n = 1;
+                while (mask) {
+                    int i = LowestBit(mask);
+                    mask &= mask - 1;
+                    Entry h = { node.child[i], node.count[i], tNear[i] };
+                    int j = n++;
+                    while (j > 0 && hits[j - 1].t < h.t) {
+                        hits[j] = hits[j - 1];
+                        --j;
+                    }
+                    hits[j] = h;
+                }
+                for (int i = 0; i < n - 1; ++i)
+                    stack[sp++] = hits[i];
+                current = hits[n - 1];
+                continue;
+            }
+        }
+
+        // Pop the next entry that can still be closer than the best hit
+        do {
+            if (sp == 0) return hitAny;
+            current = stack[--sp];
+        } while (current.t > tMax);
+    }
+}
+
+template <int N>
+bool WideBVHIntersect(
+    const WideBVH<N>& bvh,
+    const ray& ray,
+    hit_record& rec,
+    float tMin = 0.001f,
+    float tMax = std::numeric_limits<float>::max()
+) {
+    const auto& objects = *bvh.binary->objects;
+    const int* primIndices = bvh.binary->primIndices.data();
+    return TraverseWideBVH(bvh, ray, tMax, [&](int offset, int count, float& tMax) {
+        bool hitAny = false;
+        for (int i = offset; i < offset + count; i++) {
+            if (hit_object(*objects[primIndices[i]], ray, interval(tMin, tMax), rec)) {
+                tMax = rec.t;
+                hitAny = true;
+            }
+        }
+        return hitAny;
+    });
+}
+
+#endif